@@ -0,0 +1,248 @@
+#include "Program.h"
+#include "RomList.h"
+#include <fstream>
+#include <map>
+#include <sstream>
+
+// Recompiles a ROM ahead of time to C++ (see Program.h). The control flow graph
+// is recovered from the jumps, calls, returns and skips reachable from 0x200,
+// and every address the program can carry on at becomes the start of a block of
+// its own. The output defines chip8Program; 'make compiled ROM=...' builds it
+// into chip-8-compiled, a batch runner that runs that ROM natively.
+
+static const unsigned MAX_LENGTH = 64; // Instructions per block at most, as the block engine
+
+enum Kind
+{
+        STRAIGHT,    // Compiled, carries on with the next instruction
+        BRANCH,      // Compiled, ends the block
+        INTERPRETED, // Left to the interpreter, which carries on with the next instruction
+        STOP         // Left to the interpreter, which stops the machine on it
+};
+
+static Kind classify(unsigned short op)
+{ // What Chip8::decode makes of op in plain CHIP-8
+        unsigned nn = op & 0xFF;
+        switch(op >> 12)
+        {
+        case 0x0:
+                return op == 0x00E0 ? INTERPRETED : op == 0x00EE ? BRANCH : STOP;
+        case 0x1: case 0x2: case 0x3: case 0x4: case 0x5: case 0x9: case 0xB:
+                return BRANCH;
+        case 0x6: case 0x7: case 0xA: case 0xC:
+                return STRAIGHT;
+        case 0x8:
+                return (op & 0xF) <= 7 || (op & 0xF) == 0xE ? STRAIGHT : STOP;
+        case 0xD:
+                return INTERPRETED; // Drawing is the interpreter's business
+        case 0xE:
+                return nn == 0x9E || nn == 0xA1 ? BRANCH : STOP;
+        default:
+                if(nn == 0x07 || nn == 0x15 || nn == 0x18 || nn == 0x1E || nn == 0x29 || nn == 0x65)
+                        return STRAIGHT;
+                if(nn == 0x0A || nn == 0x33 || nn == 0x55)
+                        return INTERPRETED; // FX0A waits, the other two write memory
+                return STOP;
+        }
+}
+
+static string literal(uint64_t value)
+{ // Hexadecimal, as the handlers write their constants
+        ostringstream out;
+        out << "0x" << uppercase << hex << value;
+        return out.str();
+}
+
+static string V(unsigned x)
+{
+        return "s.V[" + literal(x) + "]";
+}
+
+static void compile(ostream& out, unsigned short op, unsigned short address)
+{ // Writes what op's handler in Chip8.cpp does, pc included for branches
+        const unsigned x = (op >> 8) & 0xF, y = (op >> 4) & 0xF, n = op & 0xF, nn = op & 0xFF, nnn = op & 0xFFF;
+        const string VX = V(x), VY = V(y), VF = V(0xF);
+        const string next = literal(address + 2), skip = literal(address + 4);
+
+        out << "        ";
+        switch(op >> 12)
+        {
+        case 0x0: out << "s.sp = (s.sp - 1) & 0xF; s.pc = s.stack[s.sp] + 2;"; break;
+        case 0x1: out << "s.pc = " << literal(nnn) << ";"; break;
+        case 0x2: out << "s.stack[s.sp] = " << literal(address) << "; s.sp = (s.sp + 1) & 0xF; s.pc = " << literal(nnn) << ";"; break;
+        case 0x3: out << "s.pc = " << VX << " == " << literal(nn) << " ? " << skip << " : " << next << ";"; break;
+        case 0x4: out << "s.pc = " << VX << " != " << literal(nn) << " ? " << skip << " : " << next << ";"; break;
+        case 0x5: out << "s.pc = " << VX << " == " << VY << " ? " << skip << " : " << next << ";"; break;
+        case 0x6: out << VX << " = " << literal(nn) << ";"; break;
+        case 0x7: out << VX << " += " << literal(nn) << ";"; break;
+        case 0x8:
+                switch(n)
+                {
+                case 0x0: out << VX << " = " << VY << ";"; break;
+                case 0x1: out << VX << " |= " << VY << "; " << VF << " = 0;"; break;
+                case 0x2: out << VX << " &= " << VY << ";"; break;
+                case 0x3: out << VX << " ^= " << VY << ";"; break;
+                case 0x4: out << VF << " = " << VY << " > 0xFF - " << VX << " ? 1 : 0; " << VX << " += " << VY << ";"; break;
+                case 0x5: out << VF << " = " << VY << " > " << VX << " ? 0 : 1; " << VX << " -= " << VY << ";"; break;
+                case 0x6: out << VF << " = " << VX << " & 0x1; " << VX << " >>= 1;"; break;
+                case 0x7: out << VF << " = " << VX << " > " << VY << " ? 0 : 1; " << VX << " = " << VY << " - " << VX << ";"; break;
+                default:  out << VF << " = " << VX << " >> 7; " << VX << " <<= 1;"; break;
+                }
+                break;
+        case 0x9: out << "s.pc = " << VX << " != " << VY << " ? " << skip << " : " << next << ";"; break;
+        case 0xA: out << "s.I = " << literal(nnn) << ";"; break;
+        case 0xB: out << "s.pc = (" << literal(nnn) << " + s.V[0x0]) & 0x0FFF;"; break;
+        case 0xC:
+                out << "s.rng ^= s.rng << 13; s.rng ^= s.rng >> 17; s.rng ^= s.rng << 5; "
+                    << VX << " = (unsigned char) (s.rng >> 24) & " << literal(nn) << ";";
+                break;
+        case 0xE:
+                out << "s.pc = s.key[" << VX << " & 0xF] " << (nn == 0x9E ? "!=" : "==") << " 0 ? " << skip << " : " << next << ";";
+                break;
+        default:
+                switch(nn)
+                {
+                case 0x07: out << VX << " = s.delay_timer;"; break;
+                case 0x15: out << "s.delay_timer = " << VX << ";"; break;
+                case 0x18: out << "s.sound_timer = " << VX << ";"; break;
+                case 0x1E: out << VF << " = s.I + " << VX << " > 0xFFF ? 1 : 0; s.I += " << VX << ";"; break;
+                case 0x29: out << "s.I = " << VX << " * 5;"; break;
+                default:
+                        for(unsigned i = 0; i <= x; ++i)
+                        {
+                                out << V(i) << " = s.memory[(s.I + " << i << ") & 0xFFF]; ";
+                        }
+                        out << "s.I += " << x + 1 << ";";
+                        break;
+                }
+                break;
+        }
+        out << " // " << literal(op) << "\n";
+}
+
+struct Block
+{
+        unsigned short end;
+        unsigned count;
+        string code;
+};
+
+int main(int argc, char** argv)
+{
+        if(argc < 2 || argc > 3)
+        {
+                cerr << "Usage: " << argv[0] << " <rom> [output.cpp]" << endl;
+                return 1;
+        }
+
+        RomImage image;
+        if(!image.read(argv[1]))
+                return 1;
+        if(image.size > RomImage::SMALL_AREA)
+        {
+                cerr << argv[1] << " doesn't fit in plain CHIP-8's " << RomImage::SMALL_AREA << " bytes" << endl;
+                return 1;
+        }
+        unsigned char memory[4096] = {0};
+        memcpy(memory + RomImage::PROGRAM_START, &image.bytes[0], image.size);
+
+        map<unsigned, Block> blocks;
+        vector<unsigned> pending(1, RomImage::PROGRAM_START);
+        vector<bool> seen(4096, false);
+        unsigned instructions = 0;
+        while(!pending.empty())
+        {
+                unsigned start = pending.back();
+                pending.pop_back();
+                if(start < RomImage::PROGRAM_START || start >= 4096 - 1 || (start & 1) || seen[start])
+                        continue; // Odd addresses are the interpreter's, as they are for the other engines
+                seen[start] = true;
+
+                Block block;
+                ostringstream code;
+                unsigned address = start;
+                block.count = 0;
+                while(true)
+                {
+                        unsigned short op = memory[address] << 8 | memory[address + 1];
+                        Kind kind = classify(op);
+                        if(kind == INTERPRETED)
+                                pending.push_back(address + 2);
+                        if(kind == INTERPRETED || kind == STOP)
+                        {
+                                code << "        s.pc = " << literal(address) << ";\n";
+                                break;
+                        }
+
+                        compile(code, op, address);
+                        ++block.count;
+                        if(kind == BRANCH)
+                        {
+                                if((op >> 12) == 0x1 || (op >> 12) == 0x2)
+                                        pending.push_back(op & 0xFFF);
+                                if((op >> 12) != 0x0 && (op >> 12) != 0x1 && (op >> 12) != 0xB)
+                                { // Calls come back to the next instruction, skips go to it or the one after
+                                        pending.push_back(address + 2);
+                                        if((op >> 12) != 0x2)
+                                                pending.push_back(address + 4);
+                                }
+                                address += 2;
+                                break;
+                        }
+
+                        address += 2;
+                        if(block.count == MAX_LENGTH || address >= 4096 - 1)
+                        {
+                                pending.push_back(address);
+                                code << "        s.pc = " << literal(address) << ";\n";
+                                break;
+                        }
+                }
+
+                if(block.count == 0)
+                        continue; // Starts with an instruction the interpreter runs
+                block.end = address;
+                block.code = code.str();
+                blocks[start] = block;
+                instructions += block.count;
+        }
+
+        if(blocks.empty())
+        {
+                cerr << argv[1] << " has nothing to compile" << endl;
+                return 1;
+        }
+
+        ofstream file;
+        if(argc == 3)
+        {
+                file.open(argv[2]);
+                if(!file)
+                {
+                        cerr << "Can't write " << argv[2] << endl;
+                        return 1;
+                }
+        }
+        ostream& out = argc == 3 ? file : cout;
+
+        out << "// Generated by chip-8-aot from " << argv[1] << ", " << blocks.size() << " blocks of "
+            << instructions << " instructions in all. Don't edit, regenerate.\n"
+            << "#include \"Program.h\"\n\n";
+        for(map<unsigned, Block>::iterator b = blocks.begin(); b != blocks.end(); ++b)
+        {
+                out << "static void block_" << literal(b->first).substr(2) << "(Chip8State& s)\n{\n" << b->second.code << "}\n\n";
+        }
+
+        out << "static const Chip8Compiled blocks[] =\n        {\n";
+        for(map<unsigned, Block>::iterator b = blocks.begin(); b != blocks.end(); ++b)
+        {
+                out << "                { " << literal(b->first) << ", " << literal(b->second.end) << ", " << b->second.count
+                    << ", &block_" << literal(b->first).substr(2) << " },\n";
+        }
+        out << "        };\n\n"
+            << "extern const Chip8Program chip8Program = { " << literal(image.hash) << "ULL, " << image.size
+            << ", sizeof(blocks) / sizeof(blocks[0]), blocks };\n";
+
+        cerr << argv[1] << ": " << blocks.size() << " blocks, " << instructions << " instructions" << endl;
+        return 0;
+}
@@ -0,0 +1,202 @@
+#include "Chip8.h"
+#include "Scheduler.h"
+#include "ScriptedInput.h"
+#include "RomList.h"
+#include "WorkPool.h"
+#include "Lockstep.h"
+#include "Program.h"
+#include "Pool.h"
+#include <chrono>
+#include <string.h>
+
+// Runs many independent machines in parallel for ROM regression testing and
+// fuzzing: every ROM gets `instances` machines, each with its own seed driving
+// both the scripted input and CXNN, and each runs headless for a fixed
+// instruction budget. Prints one CSV line per instance with a hash of the final
+// frame, so two runs (or two builds) can be diffed; instances that stopped on
+// an unknown opcode are also reported on stderr. With --lockstep N the
+// instances of a ROM run N at a time on a Chip8Lockstep instead, which gives
+// the same results. Each ROM file is read once, up front, into the image
+// every instance boots: machines come from a Chip8Pool, which resets them
+// from it rather than building one per instance. Built as chip-8-compiled (CHIP8_COMPILED), the
+// instances of the ROM compiled in by chip-8-aot run its native blocks.
+
+#ifdef CHIP8_COMPILED
+extern const Chip8Program chip8Program; // The output of chip-8-aot
+#endif
+
+struct Job
+{
+        const string* name;
+        const RomImage* rom;
+        unsigned seed;
+        unsigned long instructions;
+        unsigned long frames;
+        uint64_t frameHash;
+        unsigned short pc;
+        bool unknown; // Stopped on an opcode that doesn't exist, at pc
+        unsigned short opcode;
+};
+
+static void runJob(Job& job, Chip8Pool& machines, Chip8::Engine engine, unsigned long budget, unsigned hz)
+{
+        Chip8& chip8 = *machines.take(*job.rom, Chip8::CHIP8); // Only ROMs that fit made it into a job
+        ScriptedInput input(job.seed);
+        if(chip8.getEngine() != engine)
+                chip8.setEngine(engine); // Once per machine, switching throws away what was translated
+        chip8.setSeed(job.seed);
+        chip8.setInput(&input);
+#ifdef CHIP8_COMPILED
+        chip8.setProgram(&chip8Program); // Only takes for the ROM it was compiled from
+#endif
+
+        Chip8Scheduler scheduler(chip8, hz);
+        scheduler.setTurbo(true);
+
+        job.instructions = 0;
+        job.frames = 0;
+        while(job.instructions < budget && chip8.getChipState())
+        {
+                job.instructions += scheduler.runFrame();
+                ++job.frames;
+        }
+        job.frameHash = chip8.getFrame().hash();
+        job.pc = chip8.getPC();
+        job.unknown = chip8.getUnknownOpcode(job.opcode);
+        machines.giveBack(&chip8);
+}
+
+static void runGroup(Job* group, unsigned count, unsigned long budget, unsigned hz)
+{ // Runs `count` instances of the same ROM in lockstep
+        Chip8Lockstep* lockstep = new Chip8Lockstep(count, hz);
+        vector<ScriptedInput> inputs;
+        for(unsigned l = 0; l < count; ++l)
+        {
+                inputs.push_back(ScriptedInput(group[l].seed));
+        }
+        for(unsigned l = 0; l < count; ++l)
+        {
+                lockstep->setSeed(l, group[l].seed);
+                lockstep->setInput(l, &inputs[l]);
+        }
+        lockstep->loadROM(*group[0].rom);
+
+        // As many frames as a lone instance takes to reach the budget (the credit starts out empty)
+        lockstep->runFrames((budget * Chip8Scheduler::TIMER_HZ + hz - 1) / hz);
+
+        for(unsigned l = 0; l < count; ++l)
+        {
+                group[l].instructions = lockstep->getInstructions(l);
+                group[l].frames = lockstep->getFrames(l);
+                group[l].frameHash = lockstep->getFrame(l).hash();
+                group[l].pc = lockstep->getPC(l);
+                group[l].unknown = lockstep->getUnknownOpcode(l, group[l].opcode);
+        }
+        delete lockstep;
+}
+
+int main(int argc, char** argv)
+{
+        unsigned instances = 16;
+        unsigned long budget = 1000000;
+        unsigned hz = 1000;
+        unsigned seed = 1;
+        unsigned threads = 0;
+        unsigned lanes = 0;
+        Chip8::Engine engine = Chip8::INTERPRETER;
+        vector<string> roms;
+
+        for(int i = 1; i < argc; ++i)
+        {
+                if(strcmp(argv[i], "--instances") == 0 && i + 1 < argc)
+                        instances = strtoul(argv[++i], NULL, 10);
+                else if(strcmp(argv[i], "--instructions") == 0 && i + 1 < argc)
+                        budget = strtoul(argv[++i], NULL, 10);
+                else if(strcmp(argv[i], "--hz") == 0 && i + 1 < argc)
+                        hz = strtoul(argv[++i], NULL, 10);
+                else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+                        seed = strtoul(argv[++i], NULL, 10);
+                else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+                        threads = strtoul(argv[++i], NULL, 10);
+                else if(strcmp(argv[i], "--lockstep") == 0 && i + 1 < argc)
+                        lanes = strtoul(argv[++i], NULL, 10);
+                else if(strcmp(argv[i], "--blocks") == 0)
+                        engine = Chip8::BLOCKS;
+                else if(strcmp(argv[i], "--jit") == 0)
+                        engine = Chip8::JIT;
+                else
+                        listROMs(argv[i], roms);
+        }
+
+        if(hz < Chip8Scheduler::TIMER_HZ || instances == 0 || lanes > Chip8Lockstep::MAX_LANES)
+        {
+                cerr << "Usage: " << argv[0] << " [--instances N] [--instructions N] [--hz N] [--seed N]"
+                     << " [--threads N] [--blocks | --jit | --lockstep LANES] [rom or directory...]" << endl;
+                return 1;
+        }
+        if(roms.empty())
+                listROMs("c8games", roms);
+
+        RomCache cache;
+        vector<const string*> names;
+        vector<const RomImage*> images;
+        for(unsigned r = 0; r < roms.size(); ++r)
+        { // Files that aren't ROMs (or don't fit) are reported and left out
+                const RomImage* image = cache.load(roms[r]);
+                if(image && Chip8::fits(*image, Chip8::CHIP8))
+                {
+                        names.push_back(&roms[r]);
+                        images.push_back(image);
+                }
+        }
+
+        // Instance i of a ROM runs with seed + i, so results don't depend on the thread count
+        vector<Job> jobs(images.size() * instances);
+        for(unsigned i = 0; i < jobs.size(); ++i)
+        {
+                jobs[i].name = names[i / instances];
+                jobs[i].rom = images[i / instances];
+                jobs[i].seed = seed + i % instances;
+        }
+
+        WorkPool pool(threads);
+        Chip8Pool machines;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if(lanes)
+        { // One pool job per group of up to `lanes` instances of a ROM
+                unsigned groups = (instances + lanes - 1) / lanes;
+                pool.run(images.size() * groups, [&](unsigned g)
+                {
+                        unsigned first = g % groups * lanes;
+                        unsigned count = instances - first < lanes ? instances - first : lanes;
+                        runGroup(&jobs[g / groups * instances + first], count, budget, hz);
+                });
+        } else
+        {
+                pool.run(jobs.size(), [&](unsigned i)
+                {
+                        runJob(jobs[i], machines, engine, budget, hz);
+                });
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        unsigned long total = 0;
+        cout << "rom,seed,instructions,frames,frame_hash,pc" << endl;
+        for(unsigned i = 0; i < jobs.size(); ++i)
+        {
+                const Job& job = jobs[i];
+                cout << *job.name << ',' << dec << job.seed << ',' << job.instructions << ',' << job.frames << ','
+                     << hex << job.frameHash << ',' << job.pc << endl;
+                if(job.unknown)
+                        cerr << *job.name << " (seed " << dec << job.seed << "): unknown opcode " << hex << job.opcode
+                             << " at " << job.pc << endl;
+                total += job.instructions;
+        }
+
+        cerr << dec << jobs.size() << " instances on " << pool.getThreads() << " threads";
+        if(!lanes)
+                cerr << " and " << machines.getBuilt() << " machines";
+        cerr << ": " << total
+             << " instructions in " << seconds << " s (" << total / seconds / 1e6 << " MIPS)" << endl;
+        return 0;
+}
@@ -0,0 +1,181 @@
+#include "Chip8.h"
+#include "Scheduler.h"
+#include "ScriptedInput.h"
+#include "RomList.h"
+#include <chrono>
+#include <string.h>
+
+// Benchmarks the core over a ROM corpus: every ROM runs headless in turbo mode
+// for a fixed instruction budget with scripted input, once timed and once
+// stepped to collect a histogram of the opcode classes it executed. Results
+// are printed as CSV (default) or JSON, one record per ROM and engine. Rates
+// count only the instructions actually dispatched: cycles the machine fast-
+// forwarded (trips round a loop going nowhere, waiting on FX0A) use up the
+// budget but aren't run, so they'd only inflate them.
+
+static const char* CLASS_NAMES[16] =
+        {
+                "sys", "jp", "call", "se", "sne", "sexy", "ld", "add",
+                "alu", "snexy", "ldi", "jpv0", "rnd", "drw", "skp", "fx"
+        };
+
+struct Result
+{
+        string rom;
+        const char* engine;
+        unsigned long instructions;
+        unsigned long dispatched; // instructions less the ones fast-forwarded
+        unsigned long frames;
+        double seconds;
+        unsigned long histogram[16];
+};
+
+static Result bench(const string& name, const RomImage& rom, Chip8::Engine engine, unsigned long budget, unsigned hz, unsigned seed)
+{
+        Result result;
+        result.rom = name;
+        result.engine = engine == Chip8::JIT ? "jit" : engine == Chip8::BLOCKS ? "blocks" : "interpreter";
+        result.frames = 0;
+        memset(result.histogram, 0, sizeof(result.histogram));
+
+        { // Timed pass
+                Chip8 chip8;
+                ScriptedInput input(seed);
+                chip8.setEngine(engine);
+                chip8.setSeed(seed);
+                chip8.setInput(&input);
+                chip8.loadROM(rom);
+
+                Chip8Scheduler scheduler(chip8, hz);
+                scheduler.setTurbo(true);
+
+                unsigned long executed = 0;
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                while(executed < budget && chip8.getChipState())
+                {
+                        executed += scheduler.runFrame();
+                        ++result.frames;
+                }
+                result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                result.instructions = executed;
+                result.dispatched = executed - chip8.getFastForwarded();
+        }
+
+        { // Stepped pass with the same input, classifying each instruction before it runs
+                Chip8 chip8;
+                ScriptedInput input(seed);
+                chip8.setSeed(seed);
+                chip8.setInput(&input);
+                chip8.loadROM(rom);
+
+                unsigned perFrame = hz / Chip8Scheduler::TIMER_HZ;
+                unsigned long executed = 0;
+                while(executed < result.instructions && chip8.getChipState())
+                {
+                        for(unsigned i = 0; i < perFrame && executed < result.instructions && chip8.getChipState(); ++i, ++executed)
+                        {
+                                ++result.histogram[chip8.getOpcode() >> 12];
+                                chip8.emulateCycle();
+                        }
+                        chip8.tickTimers();
+                }
+        }
+
+        return result;
+}
+
+static void printCSVHeader()
+{
+        cout << "rom,engine,instructions,dispatched,frames,seconds,instructions_per_second,ns_per_instruction,draw_calls";
+        for(int c = 0; c < 16; ++c)
+                cout << ",op_" << CLASS_NAMES[c];
+        cout << endl;
+}
+
+static void printCSV(const Result& r)
+{
+        cout << r.rom << ',' << r.engine << ',' << r.instructions << ',' << r.dispatched << ',' << r.frames << ','
+             << r.seconds << ',' << (unsigned long) (r.dispatched / r.seconds) << ','
+             << r.seconds * 1e9 / r.dispatched << ',' << r.histogram[0xD];
+        for(int c = 0; c < 16; ++c)
+                cout << ',' << r.histogram[c];
+        cout << endl;
+}
+
+static void printJSON(const Result& r, bool first)
+{
+        cout << (first ? "  " : ", ")
+             << "{\"rom\": \"" << r.rom << "\", \"engine\": \"" << r.engine << "\""
+             << ", \"instructions\": " << r.instructions << ", \"dispatched\": " << r.dispatched
+             << ", \"frames\": " << r.frames << ", \"seconds\": " << r.seconds
+             << ", \"instructions_per_second\": " << (unsigned long) (r.dispatched / r.seconds)
+             << ", \"ns_per_instruction\": " << r.seconds * 1e9 / r.dispatched
+             << ", \"draw_calls\": " << r.histogram[0xD] << ", \"opcodes\": {";
+        for(int c = 0; c < 16; ++c)
+                cout << (c ? ", " : "") << '"' << CLASS_NAMES[c] << "\": " << r.histogram[c];
+        cout << "}}" << endl;
+}
+
+int main(int argc, char** argv)
+{
+        unsigned long budget = 5000000;
+        unsigned hz = 1000000;
+        unsigned seed = 1;
+        bool json = false;
+        vector<Chip8::Engine> engines;
+        vector<string> roms;
+
+        for(int i = 1; i < argc; ++i)
+        {
+                if(strcmp(argv[i], "--instructions") == 0 && i + 1 < argc)
+                        budget = strtoul(argv[++i], NULL, 10);
+                else if(strcmp(argv[i], "--hz") == 0 && i + 1 < argc)
+                        hz = strtoul(argv[++i], NULL, 10);
+                else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+                        seed = strtoul(argv[++i], NULL, 10);
+                else if(strcmp(argv[i], "--json") == 0)
+                        json = true;
+                else if(strcmp(argv[i], "--interpreter") == 0)
+                        engines.push_back(Chip8::INTERPRETER);
+                else if(strcmp(argv[i], "--blocks") == 0)
+                        engines.push_back(Chip8::BLOCKS);
+                else if(strcmp(argv[i], "--jit") == 0)
+                        engines.push_back(Chip8::JIT);
+                else
+                        listROMs(argv[i], roms);
+        }
+
+        if(hz < Chip8Scheduler::TIMER_HZ)
+        {
+                cerr << "Usage: " << argv[0] << " [--instructions N] [--hz N] [--seed N] [--json]"
+                     << " [--interpreter] [--blocks] [--jit] [rom or directory...]" << endl;
+                return 1;
+        }
+        if(roms.empty())
+                listROMs("c8games", roms);
+        if(engines.empty())
+        {
+                engines.push_back(Chip8::INTERPRETER);
+                engines.push_back(Chip8::BLOCKS);
+                engines.push_back(Chip8::JIT);
+        }
+
+        json ? (void) (cout << "[" << endl) : printCSVHeader();
+        bool first = true;
+        RomCache cache; // Each pass reloads the ROM from memory rather than from disk
+        for(unsigned r = 0; r < roms.size(); ++r)
+        {
+                const RomImage* image = cache.load(roms[r]);
+                if(!image)
+                        continue;
+                for(unsigned e = 0; e < engines.size(); ++e)
+                {
+                        Result result = bench(roms[r], *image, engines[e], budget, hz, seed);
+                        json ? printJSON(result, first) : printCSV(result);
+                        first = false;
+                }
+        }
+        if(json)
+                cout << "]" << endl;
+        return 0;
+}
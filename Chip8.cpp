@@ -1,13 +1,14 @@
 #include "Chip8.h"
+#include "Jit.h"
+#include "Program.h"
 
 Chip8::Chip8()
 {
         // Initilize
         pc = 0x200; // Programs for Chip-8 always start at address 0x200 forward
-        opcode = 0;
         I = 0;
         sp = 0;
-        srand(time(NULL));
+        setSeed(time(NULL));
 
         // Load fontset (0x50 and forward)
         for(int i = 0; i < 80; ++i)
@@ -16,428 +17,1261 @@ Chip8::Chip8()
         }
 
         isOn = true;
+        stoppedOnUnknown = false;
+        unknownOpcode = 0;
         drawFlag = false;
+        gfxDirty = false;
+        spinning = false;
+        keysAtSpin = 0;
+        fastForward = true;
+        fastForwarded = 0;
 
-        // Set up sound to continously play a sine wave
-        double x = 0;
-        for (unsigned i = 0; i < SAMPLES; i++)
+        delay_timer = 0;
+        sound_timer = 0;
+
+        // No frontend attached: no keys held, silent and nothing drawn
+        input = NULL;
+        audio = NULL;
+        video = NULL;
+        trace = NULL;
+        profile = NULL;
+
+        engine = INTERPRETER;
+        jit = NULL;
+        program = NULL;
+        memoryMask = 0xFFF;
+        cache = undecoded();
+
+        invalidateAll();
+}
+
+Chip8::~Chip8()
+{
+        setEngine(INTERPRETER); // Frees the translated blocks
+        if(cache != undecoded())
+                delete[] cache;
+}
+
+Chip8::Instruction* Chip8::undecoded()
+{ // The predecode cache of every machine that hasn't decoded anything, with nothing in it
+        static vector<Instruction> entries(4096 / 2, Instruction{&Chip8::DECODE});
+        return &entries[0];
+}
+
+const unsigned char Chip8::fontset[80] =
         {
-                raw[i] = AMPLITUDE * sin(x*TWO_PI);
-                x += increment;
-        }
+                0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+                0x20, 0x60, 0x20, 0x20, 0x70, // 1
+                0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+                0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+                0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+                0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+                0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+                0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+                0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+                0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+                0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+                0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+                0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+                0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+                0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+                0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+        };
 
-        if (!Buffer.loadFromSamples(raw, SAMPLES, 1, SAMPLE_RATE))
+const unsigned char Chip8::bigFontset[160] =
         {
-                std::cerr << "Loading failed!" << std::endl;
-        }
+                0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+                0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+                0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+                0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+                0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+                0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+                0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+                0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+                0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+                0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+                0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+                0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+                0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+                0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+                0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+                0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+        };
+
+#define NAMED(handler) { &Chip8::handler, #handler },
+const Chip8::HandlerName Chip8::handlerNames[KINDS + 1] =
+        {
+                CHIP8_HANDLERS(NAMED)
+                { NULL, NULL }
+        };
+#undef NAMED
 
-        Sound.setBuffer(Buffer);
-        Sound.setLoop(true);
+void Chip8::decode(Instruction& in, unsigned short op)
+{ // Looks the handler up and pulls the operands out of an opcode, once
+        unsigned kind = opcodeKinds[mode][op];
+        in.handler = handlerNames[kind].handler;
+        in.opcode = op;
+        in.nnn = op & 0x0FFF;
+        in.x = (op & 0x0F00) >> 8;
+        in.y = (op & 0x00F0) >> 4;
+        in.n = op & 0x000F;
+        in.nn = op & 0x00FF;
+#ifdef CHIP8_PROFILE
+        in.kind = kind;
+#endif
 }
 
-void Chip8::fetch()
-{
-        // Fetch opcode from memory
-        opcode = memory[pc] << 8 | memory[pc + 1];
+inline unsigned char& Chip8::at(unsigned address)
+{ // The byte at address, wrapping round the end of the mode's memory. Only XO-CHIP reaches past the 4 KB in the state
+        address &= memoryMask;
+        return address < 0x1000 ? memory[address] : upperMemory[address - 0x1000];
 }
 
-void Chip8::execute()
+inline unsigned char Chip8::at(unsigned address) const
 {
-	(this->*Chip8Table[opcode >> 12])(); 
+        address &= memoryMask;
+        return address < 0x1000 ? memory[address] : upperMemory[address - 0x1000];
+}
+
+void Chip8::invalidate(unsigned short address, unsigned short length)
+{ // Memory from address on was written, length bytes wrapping round the end of memory as the writes do: forget what was decoded there
+        unsigned start = address & memoryMask;
+        unsigned end = start + length;
+        if(start < 0x1000) // XO-CHIP's memory past 4 KB never holds decoded code
+                forget(start, end < 0x1000 ? end : 0x1000);
+        if(end > memoryMask + 1)
+                forget(0, end - (memoryMask + 1));
 }
 
-void Chip8::update()
+void Chip8::forget(unsigned start, unsigned end)
+{ // Drops whatever was decoded, translated or compiled from [start, end), which doesn't wrap
+        if(cache != undecoded())
+        {
+                for(unsigned a = start; a < end; ++a)
+                {
+                        cache[a >> 1].handler = &Chip8::DECODE;
+#ifdef CHIP8_PROFILE
+                        cache[a >> 1].kind = 0;
+#endif
+                }
+        }
+
+        if(engine != INTERPRETER)
+                retireBlocks(start, end - start);
+        if(program)
+                dropCompiled(start, end - start);
+}
+
+void Chip8::invalidateAll()
 {
+        if(cache != undecoded())
+        {
+                for(int i = 0; i < 4096 / 2; ++i)
+                {
+                        cache[i].handler = &Chip8::DECODE;
+#ifdef CHIP8_PROFILE
+                        cache[i].kind = 0;
+#endif
+                }
+        }
+
+        if(engine != INTERPRETER)
+                retireBlocks(0, 4096);
+        if(program)
+                dropCompiled(0, 4096);
+}
+
+void Chip8::tickTimers()
+{ // Called 60 times per emulated second, independently of how many instructions ran in between
         // Start by checking state of keyboard
-        for(int i = 0; i < 16; ++i)
+        if(input)
         {
-                key[i] = sf::Keyboard::isKeyPressed(keyNum[i]);
+                unsigned short keys = input->pollKeys();
+                for(int i = 0; i < 16; ++i)
+                {
+                        key[i] = (keys >> i) & 1;
+                }
         }
 
         // Update timers
         if(delay_timer > 0)
                 --delay_timer;
 
-        if(sound_timer > 0)
-        { // Chip-8 defines a single beep to be played whenever the sound timer is non-zero
-                if(Sound.getStatus() != sf::Sound::Status::Playing)
-                { // Only start playing sound if sound isn't already playing
-                        Sound.play();
-                }
+        // Chip-8 defines a single beep to be played whenever the sound timer is non-zero
+        bool beep = sound_timer > 0;
+        if(beep)
                 --sound_timer;
-        } else
+
+        if(audio)
+                audio->tick(beep);
+
+        if(gfxDirty)
+                publishFrame();
+}
+
+void Chip8::publishFrame()
+{ // Publish the new frame and hand it to the display
+        Chip8Frame frame = getFrame();
+        for(int p = 0; p < frame.planes; ++p)
+        { // Only the words the current resolution uses
+                memcpy(front[p], gfx[p], frame.height * frame.stride() * sizeof(uint64_t));
+        }
+        gfxDirty = false;
+        drawFlag = true;
+
+        if(video)
         {
-                Sound.stop();
+                video->drawFrame(getFrame());
+                drawFlag = false;
         }
 }
 
-vector<unsigned char>Chip8::getGFXArray()
-{ // Returns state of VRAM for graphical output
-        vector<unsigned char> v(begin(gfx), end(gfx));
-        return v;
+Chip8Frame Chip8::getFrame() const
+{ // Returns a view of the last published frame, nothing is copied
+        Chip8Frame frame = { front[0], hires ? 128 : 64, hires ? 64 : 32, mode == XOCHIP ? 2 : 1 };
+        return frame;
 }
 
-void Chip8::RESET()
+inline void Chip8::skip()
+{ // Steps over the next instruction, which in XO-CHIP may be the 4-byte 0xF000 NNNN
+        pc += 4;
+        if(mode == XOCHIP && at(pc - 2) == 0xF0 && at(pc - 1) == 0x00)
+                pc += 2;
+}
+
+void Chip8::DECODE(const Instruction& in) // Cache miss: decode the opcode at pc into its entry, then run it. emulateCycle only gets here with pc inside the first 4 KB
 {
-        (this->*Chip8Reset[opcode & 0x000F])();
+        if(cache == undecoded())
+        { // First miss: the interpreter gets a cache of its own. The other engines only come through here now and then, they decode on the spot
+                if(engine != INTERPRETER)
+                {
+                        Instruction spot;
+                        decode(spot, memory[pc] << 8 | memory[pc + 1]);
+                        (this->*spot.handler)(spot);
+                        return;
+                }
+                cache = new Instruction[4096 / 2];
+                copy(undecoded(), undecoded() + 4096 / 2, cache);
+        }
+        Instruction& entry = cache[pc >> 1];
+        decode(entry, memory[pc] << 8 | memory[pc + 1]);
+        (this->*entry.handler)(entry);
+}
+
+void Chip8::UNKNOWN(const Instruction& in) // Not an instruction: stops the machine, leaving it to the frontend to report (see getUnknownOpcode())
+{
+        stoppedOnUnknown = true;
+        unknownOpcode = in.opcode;
+        isOn = false;
 }
 
-void Chip8::CLEAR() // 0x00E0: Clear display
+void Chip8::CLEAR(const Instruction& in) // 0x00E0: Clear display (the selected planes in XO-CHIP)
 {
-        for(int i = 0; i < 64 * 32; ++i)
+        for(int p = 0; p < 2; ++p)
         {
-                gfx[i] = 0;
+                if(planes & (1 << p))
+                        memset(gfx[p], 0, sizeof(gfx[p]));
         }
-        drawFlag = true;
+        gfxDirty = true;
         pc += 2;
 }
 
-void Chip8::RETURN() // 0x00EE: Return from subroutine
+void Chip8::RETURN(const Instruction& in) // 0x00EE: Return from subroutine
 {
-        --sp;
+        sp = (sp - 1) & 0xF;
         pc = stack[sp];
         pc += 2;
 }
 
-void Chip8::JUMP() // 0x1NNN: Jump to address NNN
+void Chip8::JUMP(const Instruction& in) // 0x1NNN: Jump to address NNN
 {
-        pc = (opcode & 0x0FFF);
+        pc = in.nnn;
 }
 
-void Chip8::SUB() // 0x2NNN: Call subroutine at NNN
+void Chip8::SUB(const Instruction& in) // 0x2NNN: Call subroutine at NNN
 {
         stack[sp] = pc;
-        ++sp;
-        pc = (opcode & 0x0FFF);
+        sp = (sp + 1) & 0xF; // Wrap around rather than overwrite whatever follows the stack
+        pc = in.nnn;
 }
 
-void Chip8::SKIP_IF_VX() // 0x3XNN: Skip next instruction if VX equals NN
+void Chip8::SKIP_IF_VX(const Instruction& in) // 0x3XNN: Skip next instruction if VX equals NN
 {
-        if(V[(opcode & 0x0F00) >> 8] == (opcode & 0x00FF))
+        if(V[in.x] == in.nn)
         {
-                pc += 4;
+                skip();
         } else
         {
                 pc += 2;
         }
 }
 
-void Chip8::SKIP_IF_NOT_VX() // 0x4XNN: Skip next instruction if VX does not equal NN
+void Chip8::SKIP_IF_NOT_VX(const Instruction& in) // 0x4XNN: Skip next instruction if VX does not equal NN
 {
-        if(V[(opcode & 0x0F00) >> 8] != (opcode & 0x00FF))
+        if(V[in.x] != in.nn)
         {
-                pc += 4;
+                skip();
         } else
         {
                 pc += 2;
         }
 }
 
-void Chip8::SKIP_IF_VX_VY() // 0x5XY0: Skip next instruction if VX = VY
+void Chip8::SKIP_IF_VX_VY(const Instruction& in) // 0x5XY0: Skip next instruction if VX = VY
 {
-        if(V[(opcode & 0x0F00) >> 8] == V[(opcode & 0x00F0) >> 4])
+        if(V[in.x] == V[in.y])
         {
-                pc += 4;
+                skip();
         } else
         {
                 pc += 2;
         }
 }
 
-void Chip8::SET_VX() // 0x6XNN: Sets VX to NN
+void Chip8::SET_VX(const Instruction& in) // 0x6XNN: Sets VX to NN
 {
-        V[(opcode & 0x0F00) >> 8] = (opcode & 0x00FF);
+        V[in.x] = in.nn;
         pc += 2;
 }
 
-void Chip8::ADD_TO_VX() // 0x7XNN: Adds NN to VX
+void Chip8::ADD_TO_VX(const Instruction& in) // 0x7XNN: Adds NN to VX
 {
-        V[(opcode & 0x0F00) >> 8] += (opcode & 0x00FF);
+        V[in.x] += in.nn;
         pc += 2;
 }
 
-void Chip8::ARITHMETIC()
+void Chip8::VX_VY(const Instruction& in) // 0x8XY0: Assigns VX to VY
 {
-        (this->*Chip8Arithmetic[opcode & 0x000F])();
-}
-
-void Chip8::VX_VY() // 0x8XY0: Assigns VX to VY
-{
-        V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x00F0) >> 4];
+        V[in.x] = V[in.y];
         pc += 2;
 }
 
-void Chip8::VX_OR_VY() // 0x8XY1: Bitwise or between VX and VY. Reset VF
+void Chip8::VX_OR_VY(const Instruction& in) // 0x8XY1: Bitwise or between VX and VY. Reset VF
 {
-        V[(opcode & 0x0F00) >> 8] |= V[(opcode & 0x00F0) >> 4];
+        V[in.x] |= V[in.y];
         V[0xF] = 0;
+        pc += 2;
 }
 
-void Chip8::VX_AND_VY() // 0x8XY2: Bitwise and between VX and VY. Reset VF
+void Chip8::VX_AND_VY(const Instruction& in) // 0x8XY2: Bitwise and between VX and VY. Reset VF
 {
-        V[(opcode & 0x0F00) >> 8] &= V[(opcode & 0x00F0) >> 4];
+        V[in.x] &= V[in.y];
         pc += 2;
 }
 
-void Chip8::VX_XOR_VY() // 0x8XY3: Bitwise XOR between VX and VY. Reset VF
+void Chip8::VX_XOR_VY(const Instruction& in) // 0x8XY3: Bitwise XOR between VX and VY. Reset VF
 {
-        V[(opcode & 0x0F00) >> 8] ^= V[(opcode & 0x00F0) >> 4];
+        V[in.x] ^= V[in.y];
         pc += 2;
 }
 
-void Chip8::ADD_VY_VX() // 0x8XY4: Adds VY to VX. Carry flag is set (VF)
+void Chip8::ADD_VY_VX(const Instruction& in) // 0x8XY4: Adds VY to VX. Carry flag is set (VF)
 {
-        if(V[(opcode & 0x00F0) >> 4] > (0xFF - V[(opcode & 0x0F00) >> 8]))
+        if(V[in.y] > (0xFF - V[in.x]))
         {
                 V[0xF] = 0x01; // 1 is carry by def
         }else
         {
                 V[0xF] = 0x00; // No carry necessary
         }
-        V[(opcode & 0x0F00) >> 8] += V[(opcode & 0x00F0) >> 4];
+        V[in.x] += V[in.y];
         pc += 2;
 }
 
-void Chip8::SUB_VY_VX() // 0x8XY5: Subtract VY from VX. Borrow flag set (VF)
+void Chip8::SUB_VY_VX(const Instruction& in) // 0x8XY5: Subtract VY from VX. Borrow flag set (VF)
 {
-        if(V[(opcode & 0x00F0) >> 4] > V[(opcode & 0x0F00) >> 8])
+        if(V[in.y] > V[in.x])
         {
                 V[0xF] = 0x00;
         }else
         {
                 V[0xF] = 0x01;
         }
-        V[(opcode & 0x0F00) >> 8] -= V[(opcode & 0x00F0) >> 4];
+        V[in.x] -= V[in.y];
         pc += 2;
 }
 
-void Chip8::SHIFT_VX_RIGHT () // 0x8XY6: Shift VX right by 1. VF is set to least significant bit before shift.
+void Chip8::SHIFT_VX_RIGHT (const Instruction& in) // 0x8XY6: Shift VX right by 1. VF is set to least significant bit before shift.
 {
-        V[0xF] = V[(opcode & 0x0F00) >> 8] & 0x1; //Is the bit reached????
-        V[(opcode & 0x0F00) >> 8] >>= 1;
+        V[0xF] = V[in.x] & 0x1; //Is the bit reached????
+        V[in.x] >>= 1;
         pc += 2;
 }
 
-void Chip8::SET_VX_VY_SUB_VX() // 0x8XY7: Set VX to VY - VX. Borrow flag set (VF)
+void Chip8::SET_VX_VY_SUB_VX(const Instruction& in) // 0x8XY7: Set VX to VY - VX. Borrow flag set (VF)
 {
-        if(V[(opcode & 0x0F00) >> 8] > V[(opcode & 0x00F0) >> 4])
+        if(V[in.x] > V[in.y])
         {
                 V[0xF] = 0x00;
         }else
         {
                 V[0xF] = 0x01;
         }
-        V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x00F0) >> 4] - V[(opcode & 0x0F00) >> 8];
+        V[in.x] = V[in.y] - V[in.x];
         pc += 2;
 }
 
-void Chip8::SHIFT_VX_LEFT() // 0x8XYE: Shifts VX left by 1. VF is set to most significant bit before shift.
+void Chip8::SHIFT_VX_LEFT(const Instruction& in) // 0x8XYE: Shifts VX left by 1. VF is set to most significant bit before shift.
 {
-        V[0xF] = V[(opcode & 0x0F00) >> 8] >> 7;
-        V[(opcode & 0x0F00) >> 8] <<= 1;
+        V[0xF] = V[in.x] >> 7;
+        V[in.x] <<= 1;
         pc += 2;
 }
 
-void Chip8::SKIP_IF_VX_NOT_VY() // 0x9XY0: Skip next instruction if VX != VY.
+void Chip8::SKIP_IF_VX_NOT_VY(const Instruction& in) // 0x9XY0: Skip next instruction if VX != VY.
 {
-        if(V[(opcode & 0x0F00) >> 8] != V[(opcode & 0x00F0) >> 4])
+        if(V[in.x] != V[in.y])
         {
-                pc += 4;
+                skip();
         }else
         {
                 pc += 2;
         }
 }
 
-void Chip8::SET_I() // 0xANNN: Sets the 16-bit register to addess NNN
+void Chip8::SET_I(const Instruction& in) // 0xANNN: Sets the 16-bit register to addess NNN
 {
-        I = (opcode & 0x0FFF);
+        I = in.nnn;
         pc += 2;
 }
 
-void Chip8::JUMP_ADD_V0() // 0xBNNN: Jump to address NNN + V0
+void Chip8::JUMP_ADD_V0(const Instruction& in) // 0xBNNN: Jump to address NNN + V0
 {
-        pc = (opcode & 0x0FFF + V[0]);
+        pc = (in.nnn + V[0]) & 0x0FFF;
 }
 
-void Chip8::SET_VX_RANDOM() // 0xCXNN: Set VX to the result of AND on a random number AND NN.
+void Chip8::SET_VX_RANDOM(const Instruction& in) // 0xCXNN: Set VX to the result of AND on a random number AND NN.
 {
-        unsigned char rnd = (unsigned char) rand();
+        // xorshift32, every machine has its own so instances never share state
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        unsigned char rnd = (unsigned char) (rng >> 24);
 
-        V[(opcode & 0x0F00) >> 8] = (rnd & (opcode & 0x00FF));
+        V[in.x] = (rnd & in.nn);
         pc += 2;
 }
 
-void Chip8::DRAW() // 0xDXYN: Draw sprite at VX, VY with width 8 pixels and height of N pixels. Each row of 8 pixels is read as bit-coded starting from memory location I; I value doesn’t change after the execution of this instruction. VF is set to 1 if any screen pixels are flipped from set to unset when the sprite is drawn, and to 0 if that doesn’t happen
+void Chip8::DRAW(const Instruction& in) // 0xDXYN: Draw sprite at VX, VY with width 8 pixels and height of N pixels. Each row of 8 pixels is read as bit-coded starting from memory location I; I value doesn’t change after the execution of this instruction. VF is set to 1 if any screen pixels are flipped from set to unset when the sprite is drawn, and to 0 if that doesn’t happen
 {
-        unsigned short x = V[(opcode & 0x0F00) >> 8];
-        unsigned short y = V[(opcode & 0x00F0) >> 4];
-        unsigned short height = opcode & 0x000F;
-        unsigned short pixel;
+        unsigned x = V[in.x] & 63;
+        unsigned y = V[in.y] & 31;
 
         V[0xF] = 0;
-        for (int yline = 0; yline < height; ++yline)
-        {
-                pixel = memory[I + yline];
-                for(int xline = 0; xline < 8; ++xline)
+        for (int yline = 0; yline < in.n; ++yline)
+        { // Line the sprite byte up with column x (wrapping around the right edge) and flip the whole row at once
+                uint64_t pixels = (uint64_t) memory[(I + yline) & 0xFFF] << 56;
+                if(x)
+                        pixels = (pixels >> x) | (pixels << (64 - x));
+
+                uint64_t& row = gfx[0][(y + yline) & 31];
+                if((row & pixels) != 0)
                 {
-                        if((pixel & (0x80 >> xline)) != 0)
-                        {
-                                if(gfx[x + xline + ((y + yline) * 64)] == 1)
-                                {
-                                        V[0xF] = 1;
-                                }
-                                gfx[x + xline + ((y + yline) * 64)] ^= 1;
-                        }
+                        V[0xF] = 1;
                 }
+                row ^= pixels;
         }
 
-        drawFlag = true;
+        gfxDirty = true;
         pc += 2;
 }
 
-void Chip8::SKIP_IF_KEY()
+void Chip8::SET_I_DRAW(const Instruction& in) // 0xANNN fused with the 0xDXYN right after it
 {
-	(this->*Chip8SkipIfKey[opcode && 0x00FF])(); 
+        I = in.nnn;
+        DRAW(in);
 }
 
-void Chip8::SKIP_IF_KEY_NOT_VX() // 0xEXA1: Skip next instruction if key stored in VX isn't pressed
+void Chip8::SKIP_IF_KEY_NOT_VX(const Instruction& in) // 0xEXA1: Skip next instruction if key stored in VX isn't pressed
 {
-        if(key[V[(opcode & 0x0F00) >> 8]] == 0)
+        if(key[V[in.x] & 0xF] == 0)
         {
-                pc += 4;
+                skip();
         }else
         {
                 pc += 2;
         }
 }
 
-void Chip8::SKIP_IF_KEY_VX() // 0xEX9E: Skip next instruction if key stored in VX is pressed
+void Chip8::SKIP_IF_KEY_VX(const Instruction& in) // 0xEX9E: Skip next instruction if key stored in VX is pressed
 {
-        if(key[V[(opcode & 0x0F00) >> 8]] != 0)
+        if(key[V[in.x] & 0xF] != 0)
         {
-                pc += 4;
+                skip();
         }else
         {
                 pc += 2;
         }
 }
 
-void Chip8::OTHERS()
+void Chip8::SET_DELAY(const Instruction& in) // 0xFX15: Set delay timer to VX
+{
+        delay_timer = V[in.x];
+        pc += 2;
+}
+
+void Chip8::VX_DELAY(const Instruction& in) // 0xFX07: Set VX to value of delay timer
+{
+        V[in.x] = delay_timer;
+        pc += 2;
+}
+
+void Chip8::WAIT_KEY(const Instruction& in) // 0xFX0A: Wait for key press, then store in VX.
+{ // Keys are only read at the 60 Hz tick, so stay on this instruction until a tick brings a key that wasn't down before
+        unsigned short keys = latchedKeys();
+
+        if(!waiting)
+        {
+                waiting = 1;
+                keysAtWait = keys;
+                return;
+        }
+
+        unsigned short pressed = keys & ~keysAtWait;
+        keysAtWait = keys; // A key let go of while waiting counts again when it's pressed
+        if(pressed == 0)
+                return;
+
+        int i = 15;
+        while(!((pressed >> i) & 1))
+        { // As when the keyboard was polled in a loop here, the highest key pressed wins
+                --i;
+        }
+        V[in.x] = i;
+        waiting = 0;
+        pc += 2;
+}
+
+void Chip8::SET_SOUND(const Instruction& in) // 0xFX18: Set the sound timer to VX.
+{
+        sound_timer = V[in.x];
+        pc += 2;
+}
+
+void Chip8::ADD_VX_TO_I(const Instruction& in) // 0xFX1E: Add VX to I-register
+{
+        if(I + V[in.x] > 0xFFF)	// VF is set to 1 when range overflow (I+VX>0xFFF), and 0 when there isn't.
+                V[0xF] = 1;
+        else
+                V[0xF] = 0;
+        I += V[in.x];
+        pc += 2;
+}
+
+void Chip8::SET_I_SPRITE(const Instruction& in) // 0xFX29: Set I to the location of the sprite for the character in VX. Character 0-F (in hex) are represented by a 4x5 font.
+{
+        I = V[in.x] * 5;
+        pc += 2;
+}
+
+void Chip8::STORE_BCD(const Instruction& in) // 0xFX33: Store BCD representation of VX, with the most significant of three digits at the address in I, the middle digit at I + 1, and the least significant digit at I + 2.
+{
+        //This is some weird stuff, I didn't write this myself
+        at(I) = V[in.x] / 100;
+        at(I + 1) = (V[in.x] / 10) % 10;
+        at(I + 2) = (V[in.x] % 100) % 10;
+        invalidate(I & memoryMask, 3);
+        pc += 2;
+}
+
+void Chip8::STORE_V0_VX(const Instruction& in) // 0xFX55: Store V0 to VX in memory starting at address I.
+{
+        for(int i = 0; i <= in.x; ++i)
+        {
+                at(I + i) = V[i];
+        }
+        invalidate(I & memoryMask, in.x + 1);
+        // On the original interpreter, when the operation is done, I = I + X + 1.
+        I += in.x + 1;
+        pc += 2;
+}
+
+void Chip8::LOAD_V0_VX(const Instruction& in) // 0xFX65: Fills V0 to VX with values from memory starting at address I.
+{
+        for(int i = 0; i <= in.x; ++i)
+        {
+                V[i] = at(I + i);
+        }
+
+        I += in.x + 1;
+        pc += 2;
+}
+
+void Chip8::SCROLL_DOWN(const Instruction& in) // 0x00CN: Scroll the selected planes down N rows
+{
+        const unsigned stride = hires ? 2 : 1;
+        const unsigned words = (hires ? 64 : 32) * stride;
+        const unsigned shift = in.n * stride < words ? in.n * stride : words;
+        for(int p = 0; p < 2; ++p)
+        { // Whole rows move, a word move per row
+                if(!(planes & (1 << p)))
+                        continue;
+                memmove(gfx[p] + shift, gfx[p], (words - shift) * sizeof(uint64_t));
+                memset(gfx[p], 0, shift * sizeof(uint64_t));
+        }
+        gfxDirty = true;
+        pc += 2;
+}
+
+void Chip8::SCROLL_UP(const Instruction& in) // 0x00DN: Scroll the selected planes up N rows (XO-CHIP)
 {
-	
-                switch(opcode & 0x00FF)
+        const unsigned stride = hires ? 2 : 1;
+        const unsigned words = (hires ? 64 : 32) * stride;
+        const unsigned shift = in.n * stride < words ? in.n * stride : words;
+        for(int p = 0; p < 2; ++p)
+        {
+                if(!(planes & (1 << p)))
+                        continue;
+                memmove(gfx[p], gfx[p] + shift, (words - shift) * sizeof(uint64_t));
+                memset(gfx[p] + words - shift, 0, shift * sizeof(uint64_t));
+        }
+        gfxDirty = true;
+        pc += 2;
+}
+
+void Chip8::SCROLL_RIGHT(const Instruction& in) // 0x00FB: Scroll the selected planes right 4 pixels
+{
+        for(int p = 0; p < 2; ++p)
+        {
+                if(!(planes & (1 << p)))
+                        continue;
+                if(!hires)
                 {
-                case 0x0015: // 0xFX15: Set delay timer to VX
+                        for(int y = 0; y < 32; ++y)
+                        {
+                                gfx[p][y] >>= 4;
+                        }
+                } else
                 {
-                        delay_timer = V[(opcode & 0x0F00) >> 8];
-                        pc += 2;
+                        for(int y = 0; y < 64; ++y)
+                        { // The 4 pixels falling off the left word move into the right one
+                                uint64_t* row = &gfx[p][y * 2];
+                                row[1] = (row[1] >> 4) | (row[0] << 60);
+                                row[0] >>= 4;
+                        }
                 }
-                break;
+        }
+        gfxDirty = true;
+        pc += 2;
+}
 
-                case 0x0007: // 0xFX07: Set VX to value of delay timer
+void Chip8::SCROLL_LEFT(const Instruction& in) // 0x00FC: Scroll the selected planes left 4 pixels
+{
+        for(int p = 0; p < 2; ++p)
+        {
+                if(!(planes & (1 << p)))
+                        continue;
+                if(!hires)
+                {
+                        for(int y = 0; y < 32; ++y)
+                        {
+                                gfx[p][y] <<= 4;
+                        }
+                } else
                 {
-                        V[(opcode & 0x0F00) >> 8] = delay_timer;
-                        pc += 2;
+                        for(int y = 0; y < 64; ++y)
+                        {
+                                uint64_t* row = &gfx[p][y * 2];
+                                row[0] = (row[0] << 4) | (row[1] >> 60);
+                                row[1] <<= 4;
+                        }
                 }
-                break;
+        }
+        gfxDirty = true;
+        pc += 2;
+}
+
+void Chip8::EXIT(const Instruction& in) // 0x00FD: Exit the interpreter
+{
+        isOn = false;
+}
+
+void Chip8::LORES(const Instruction& in) // 0x00FE: Switch to 64x32, clearing the screen
+{
+        hires = 0;
+        memset(gfx, 0, sizeof(gfx));
+        gfxDirty = true;
+        pc += 2;
+}
+
+void Chip8::HIRES(const Instruction& in) // 0x00FF: Switch to 128x64, clearing the screen
+{
+        hires = 1;
+        memset(gfx, 0, sizeof(gfx));
+        gfxDirty = true;
+        pc += 2;
+}
 
-                case 0x000A: // 0xFX0A: Wait for key press, then store in VX.
+void Chip8::DRAW_PLANES(const Instruction& in) // 0xDXYN outside of plain CHIP-8: N rows of 8 pixels, or 16x16 for N = 0, in every selected plane. Sprite data for the second plane follows the first. SUPER-CHIP clips at the edges, XO-CHIP wraps around.
+{
+        const unsigned width = hires ? 128 : 64;
+        const unsigned height = hires ? 64 : 32;
+        const unsigned stride = width / 64;
+        const bool wrap = mode == XOCHIP;
+        const unsigned rows = in.n ? in.n : 16;
+        const unsigned bytes = in.n ? 1 : 2; // Per sprite row
+
+        unsigned x = V[in.x] & (width - 1);
+        unsigned y = V[in.y] & (height - 1);
+        unsigned short address = I;
+
+        V[0xF] = 0;
+        for(int p = 0; p < 2; ++p)
+        {
+                if(!(planes & (1 << p)))
+                        continue;
+
+                for(unsigned line = 0; line < rows; ++line, address += bytes)
                 {
-                        bool keepGoing = true;
-                        while(keepGoing)
+                        unsigned row = y + line;
+                        if(row >= height && !wrap)
+                                continue;
+                        row &= height - 1;
+
+                        // The sprite row at the left edge of the top word, then moved to column x
+                        uint64_t bits = (uint64_t) at(address) << 56;
+                        if(bytes == 2)
+                                bits |= (uint64_t) at(address + 1) << 48;
+
+                        uint64_t pixels[2];
+                        if(stride == 1)
+                        {
+                                pixels[0] = bits >> x;
+                                if(wrap && x)
+                                        pixels[0] |= bits << (64 - x);
+                        } else if(x < 64)
                         {
-                        for(int i = 0; i < 16; ++i)
+                                pixels[0] = bits >> x;
+                                pixels[1] = x ? bits << (64 - x) : 0;
+                        } else
                         {
-                                if(key[i] != sf::Keyboard::isKeyPressed(keyNum[i]))
-                                {
-                                        key[i] = sf::Keyboard::isKeyPressed(keyNum[i]);
-                                        V[opcode & 0x0F00 >> 8] = key[i];
-                                        keepGoing = false;
-                                }
+                                pixels[0] = wrap && x > 64 ? bits << (128 - x) : 0;
+                                pixels[1] = bits >> (x - 64);
                         }
+
+                        uint64_t* target = &gfx[p][row * stride];
+                        for(unsigned w = 0; w < stride; ++w)
+                        {
+                                if(target[w] & pixels[w])
+                                        V[0xF] = 1;
+                                target[w] ^= pixels[w];
                         }
-                        pc += 2;
                 }
-                break;
+        }
+
+        gfxDirty = true;
+        pc += 2;
+}
+
+void Chip8::SAVE_VX_VY(const Instruction& in) // 0x5XY2: Store VX to VY (in either order) at I, I doesn't change
+{
+        int step = in.x <= in.y ? 1 : -1;
+        int count = (in.x <= in.y ? in.y - in.x : in.x - in.y) + 1;
+        for(int i = 0; i < count; ++i)
+        {
+                at(I + i) = V[in.x + i * step];
+        }
+        invalidate(I & memoryMask, count);
+        pc += 2;
+}
+
+void Chip8::LOAD_VX_VY(const Instruction& in) // 0x5XY3: Load VX to VY (in either order) from I, I doesn't change
+{
+        int step = in.x <= in.y ? 1 : -1;
+        int count = (in.x <= in.y ? in.y - in.x : in.x - in.y) + 1;
+        for(int i = 0; i < count; ++i)
+        {
+                V[in.x + i * step] = at(I + i);
+        }
+        pc += 2;
+}
+
+void Chip8::SET_I_LONG(const Instruction& in) // 0xF000 NNNN: Set I to the 16-bit address in the next two bytes
+{
+        I = at(pc + 2) << 8 | at(pc + 3);
+        pc += 4;
+}
+
+void Chip8::SELECT_PLANES(const Instruction& in) // 0xFN01: Select the bitplanes N that drawing, clearing and scrolling act on
+{
+        planes = in.x & 3;
+        pc += 2;
+}
+
+void Chip8::LOAD_PATTERN(const Instruction& in) // 0xF002: Load the 16-byte audio pattern from I
+{
+        for(int i = 0; i < 16; ++i)
+        {
+                pattern[i] = at(I + i);
+        }
+        pc += 2;
+}
+
+void Chip8::SET_PITCH(const Instruction& in) // 0xFX3A: Set the audio pattern playback rate to VX
+{
+        pitch = V[in.x];
+        pc += 2;
+}
+
+void Chip8::SET_I_BIG_SPRITE(const Instruction& in) // 0xFX30: Set I to the 8x10 big font character for VX
+{
+        I = BIG_FONT + (V[in.x] & 0xF) * 10;
+        pc += 2;
+}
+
+void Chip8::STORE_FLAGS(const Instruction& in) // 0xFX75: Store V0 to VX in the user flags
+{
+        for(int i = 0; i <= in.x; ++i)
+        {
+                flags[i] = V[i];
+        }
+        pc += 2;
+}
+
+void Chip8::LOAD_FLAGS(const Instruction& in) // 0xFX85: Load V0 to VX from the user flags
+{
+        for(int i = 0; i <= in.x; ++i)
+        {
+                V[i] = flags[i];
+        }
+        pc += 2;
+}
+
+void Chip8::emulateCycle()
+{ // Emulates one cycle
+
+        if((pc & 1) || pc > 0xFFE)
+        { // Odd addresses and XO-CHIP's memory past 4 KB are never cached, decode on the spot (wrapping round at 64 KB).
+          // Past the end of 4 KB in the other modes there's no instruction, it reads as 0x0000 and stops the machine
+          // as any unknown opcode does
+                Instruction in;
+                decode(in, pc > 0xFFE && mode != XOCHIP ? 0 : at(pc) << 8 | at(pc + 1));
+                CHIP8_TRACE_RECORD(trace, pc, in.opcode, I, sp, 0);
+                CHIP8_PROFILE_START(profile, pc);
+                (this->*in.handler)(in);
+                CHIP8_PROFILE_STOP(profile, in.kind);
+        } else
+        { // Execute the pre-decoded instruction (decoding it first on a miss)
+                const Instruction& in = cache[pc >> 1];
+                CHIP8_TRACE_RECORD(trace, pc, memory[pc] << 8 | memory[pc + 1], I, sp, 0);
+                CHIP8_PROFILE_START(profile, pc);
+                (this->*in.handler)(in);
+                CHIP8_PROFILE_STOP(profile, in.kind);
+        }
+}
+
+bool Chip8::isSpinSafe(Handler h)
+{ // Instructions that change nothing but V, I, the timers and pc, and only read what stays put between ticks
+        return h == &Chip8::JUMP || h == &Chip8::SET_VX || h == &Chip8::ADD_TO_VX
+            || h == &Chip8::VX_VY || h == &Chip8::VX_OR_VY || h == &Chip8::VX_AND_VY || h == &Chip8::VX_XOR_VY
+            || h == &Chip8::ADD_VY_VX || h == &Chip8::SUB_VY_VX || h == &Chip8::SHIFT_VX_RIGHT
+            || h == &Chip8::SET_VX_VY_SUB_VX || h == &Chip8::SHIFT_VX_LEFT
+            || h == &Chip8::SKIP_IF_VX || h == &Chip8::SKIP_IF_NOT_VX || h == &Chip8::SKIP_IF_VX_VY
+            || h == &Chip8::SKIP_IF_VX_NOT_VY || h == &Chip8::SKIP_IF_KEY_VX || h == &Chip8::SKIP_IF_KEY_NOT_VX
+            || h == &Chip8::SET_I || h == &Chip8::ADD_VX_TO_I || h == &Chip8::SET_I_SPRITE
+            || h == &Chip8::VX_DELAY || h == &Chip8::SET_DELAY || h == &Chip8::SET_SOUND;
+}
 
-                case 0x0018: // 0xFX18: Set the sound timer to VX.
+unsigned long Chip8::spin(unsigned long budget)
+{ // pc in a short loop back to itself (polling the delay timer or the keys, or a jump to itself): runs it until a trip round
+  // leaves V, I and the timers as the last one did. Nothing it reads changes before the next tick, so every trip after that
+  // would be the same, and the budget's whole trips are counted as run without running them. Returns how many instructions ran
+        if((pc & 1) || waiting || trace || profile || !fastForward)
+                return 0;
+
+        // Find the jump closing the loop, looking only at instructions that can't get anything done
+        unsigned short start = 0, end = 0;
+        Instruction in;
+        for(unsigned a = pc; a < 4096 - 1 && a < pc + 2 * MAX_SPIN_LENGTH; a += 2)
+        {
+                decode(in, memory[a] << 8 | memory[a + 1]);
+                if(!isSpinSafe(in.handler))
+                        return 0;
+                if(in.handler == &Chip8::JUMP)
                 {
-                        sound_timer = V[(opcode & 0x0F00) >> 8];
-                        pc += 2;
+                        if(in.nnn > pc || a - in.nnn >= 2 * MAX_SPIN_LENGTH || (in.nnn & 1))
+                                return 0;
+                        start = in.nnn;
+                        end = a;
+                        break;
                 }
-                break;
+        }
+        if(end == 0)
+                return 0;
+        for(unsigned a = start; a < pc; a += 2)
+        {
+                decode(in, memory[a] << 8 | memory[a + 1]);
+                if(!isSpinSafe(in.handler))
+                        return 0;
+        }
 
-                case 0x001E: // 0xFX1E: Add VX to I-register
+        unsigned long executed = 0;
+        unsigned long trip = 0;
+        unsigned trips = 0;
+        unsigned char lastV[16];
+        unsigned short lastI = 0;
+        unsigned char lastDelay = 0, lastSound = 0;
+        while(executed < budget)
+        {
+                if(pc == start)
                 {
-                        if(I + V[(opcode & 0x0F00) >> 8] > 0xFFF)	// VF is set to 1 when range overflow (I+VX>0xFFF), and 0 when there isn't.
-                                V[0xF] = 1;
-                        else
-                                V[0xF] = 0;
-                        I += V[(opcode & 0x0F00) >> 8];
-                        pc += 2;
+                        if(trips > 0 && memcmp(V, lastV, 16) == 0 && I == lastI && delay_timer == lastDelay && sound_timer == lastSound)
+                        { // Came round unchanged: skip the rest of the whole trips, the remainder runs as usual
+                                unsigned long skipped = (budget - executed) / trip * trip;
+                                executed += skipped;
+                                fastForwarded += skipped;
+                                spinning = delay_timer == 0 && sound_timer == 0;
+                                keysAtSpin = latchedKeys();
+                                return executed;
+                        }
+                        if(++trips > 3)
+                                return executed; // Still getting somewhere
+                        memcpy(lastV, V, 16);
+                        lastI = I;
+                        lastDelay = delay_timer;
+                        lastSound = sound_timer;
+                        trip = 0;
                 }
-                break;
 
-                case 0x0029: // 0xFX29: Set I to the location of the sprite for the character in VX. Character 0-F (in hex) are represented by a 4x5 font.
+                emulateCycle();
+                ++executed;
+                ++trip;
+                if(pc < start || pc > end || trip > MAX_SPIN_LENGTH)
+                        return executed; // Out of the loop
+        }
+        return executed;
+}
+
+unsigned long Chip8::run(unsigned long cycles)
+{ // Executes at least `cycles` instructions (or until the machine stops) with the selected engine, returns how many ran (cycles spent waiting on FX0A, or going round a loop that can't get anywhere before the next tick, count as run). Timers are left alone, see tickTimers()
+        spinning = false;
+        unsigned long executed = spin(cycles);
+        while(executed < cycles && isOn)
+        {
+                bool aligned = !(pc & 1) && pc < 0x1000; // Blocks start at even addresses in the first 4 KB. Anywhere else emulateCycle decodes on the spot, or stops the machine past the end
+                if(program && !trace && !profile && aligned)
+                {
+                        executed += runCompiled(cycles - executed);
+                } else if(engine == BLOCKS && aligned)
+                {
+                        executed += runBlocks(cycles - executed);
+                } else if(engine == JIT && aligned)
+                {
+                        executed += runJit(cycles - executed);
+                } else
                 {
-                        I = V[(opcode & 0x0F00) >> 8] * 5;
-                        pc += 2;
+                        emulateCycle();
+                        ++executed;
+                }
+
+                if(waiting && executed < cycles)
+                { // Still on FX0A: keys only change at the next tick, so the rest of the budget goes by waiting
+                        fastForwarded += cycles - executed;
+                        executed = cycles;
+                }
+        }
+        return executed;
+}
+
+void Chip8::setFastForward(bool enabled)
+{ // Whether run() may skip trips round loops that can't get anywhere before the next tick (on by default). Off, every one of them is dispatched, which ends up in the same state
+        fastForward = enabled;
+}
+
+unsigned long Chip8::getFastForwarded() const
+{ // Of all the cycles run() has returned so far, how many were counted without dispatching anything: skipped trips round a loop going nowhere, and waiting on FX0A
+        return fastForwarded;
+}
+
+void Chip8::setEngine(Engine selected)
+{ // Switches execution engine, translated blocks only live while BLOCKS or JIT is selected
+        for(unsigned i = 0; i < blocks.size(); ++i)
+        {
+                delete blocks[i];
+        }
+        for(unsigned i = 0; i < retired.size(); ++i)
+        {
+                delete retired[i];
+        }
+        blocks.clear();
+        isCode.clear();
+        retired.clear();
+        delete jit;
+        jit = NULL;
+
+        engine = selected;
+        if(engine != INTERPRETER && cache != undecoded())
+        { // Only the interpreter runs from the predecode cache
+                delete[] cache;
+                cache = undecoded();
+        }
+        if(engine == JIT)
+        {
+                jit = new Chip8Jit;
+                if(!jit->isReady())
+                { // Not an x86-64 host, or no executable memory to be had
+                        cerr << "No JIT on this host, running blocks instead" << endl;
+                        delete jit;
+                        jit = NULL;
+                        engine = BLOCKS;
                 }
-                break;
+        }
+        if(engine != INTERPRETER)
+        {
+                blocks.resize(4096, NULL);
+                isCode.resize(4096, 0);
+        }
+}
+
+void Chip8::setMode(Mode machine)
+{ // Selects the instruction set, before loading a ROM. Starts out in low resolution with the first plane selected
+        if(machine != XOCHIP)
+                vector<unsigned char>().swap(upperMemory); // Only XO-CHIP has memory past 4 KB, the other modes don't hold on to it
+        else if(mode != XOCHIP)
+                upperMemory.assign(UPPER_MEMORY, 0);
+        mode = machine;
+        memoryMask = mode == XOCHIP ? 0xFFFF : 0xFFF;
+        hires = 0;
+        planes = 1;
+
+        // The big font only exists in the extended modes, plain CHIP-8 keeps that memory clear
+        for(int i = 0; i < 160; ++i)
+        {
+                memory[BIG_FONT + i] = mode != CHIP8 ? bigFontset[i] : 0;
+        }
+
+        invalidateAll(); // Decoding depends on the mode
+}
+
+Chip8::Engine Chip8::getEngine() const
+{ // The engine actually running, BLOCKS where the JIT wasn't available
+        return engine;
+}
+
+Chip8::Mode Chip8::getMode() const
+{
+        return (Mode) mode;
+}
+
+bool Chip8::modeFromName(const string& name, Mode& machine)
+{ // "chip8", "schip" or "xochip", as given on the command line
+        if(name == "chip8")
+                machine = CHIP8;
+        else if(name == "schip")
+                machine = SCHIP;
+        else if(name == "xochip")
+                machine = XOCHIP;
+        else
+                return false;
+        return true;
+}
+
+bool Chip8::endsBlock(const Instruction& in)
+{ // Instructions after which the next pc isn't simply the next address, or whose effect the next one must see
+        Handler h = in.handler;
+        return h == &Chip8::JUMP || h == &Chip8::SUB || h == &Chip8::RETURN || h == &Chip8::JUMP_ADD_V0
+            || h == &Chip8::SKIP_IF_VX || h == &Chip8::SKIP_IF_NOT_VX || h == &Chip8::SKIP_IF_VX_VY
+            || h == &Chip8::SKIP_IF_VX_NOT_VY || h == &Chip8::SKIP_IF_KEY_VX || h == &Chip8::SKIP_IF_KEY_NOT_VX
+            || h == &Chip8::DRAW || h == &Chip8::WAIT_KEY || h == &Chip8::UNKNOWN
+            || h == &Chip8::STORE_BCD || h == &Chip8::STORE_V0_VX || h == &Chip8::SAVE_VX_VY // Self-modifying writes
+            || h == &Chip8::DRAW_PLANES || h == &Chip8::SET_I_LONG || h == &Chip8::EXIT; // As DRAW, 4 bytes long, stops
+}
 
-                case 0x0033: // 0xFX33: Store BCD representation of VX, with the most significant of three digits at the address in I, the middle digit at I + 1, and the least significant digit at I + 2.
+Chip8::Block* Chip8::translate(unsigned short start)
+{ // Decodes the straight-line run at start once, fusing instruction pairs where possible
+        Block* block = new Block;
+        block->start = start;
+
+        unsigned short address = start;
+        unsigned count = 0;
+        Instruction in;
+        do
+        {
+                decode(in, memory[address] << 8 | memory[address + 1]);
+                block->exit = address;
+                address += 2;
+                ++count;
+
+                Instruction* prev = block->ops.empty() ? NULL : &block->ops.back();
+                if(prev && in.handler == &Chip8::ADD_TO_VX && prev->x == in.x
+                   && (prev->handler == &Chip8::SET_VX || prev->handler == &Chip8::ADD_TO_VX))
+                { // 6XNN/7XNN followed by 7XNN: fold the constants into one
+                        prev->nn += in.nn;
+                } else if(prev && in.handler == &Chip8::DRAW && prev->handler == &Chip8::SET_I)
+                { // ANNN followed by DXYN: set I and draw in one go
+                        prev->handler = &Chip8::SET_I_DRAW;
+#ifdef CHIP8_PROFILE
+                        prev->kind = KIND_SET_I_DRAW;
+#endif
+                        prev->x = in.x;
+                        prev->y = in.y;
+                        prev->n = in.n;
+                } else
                 {
-                        //This is some weird stuff, I didn't write this myself
-                        memory[I] = V[(opcode & 0x0F00) >> 8] / 100;
-                        memory[I + 1] = (V[(opcode & 0x0F00) >> 8] / 10) % 10;
-                        memory[I + 2] = (V[(opcode & 0x0F00) >> 8] % 100) % 10;
-                        pc += 2;
+                        block->ops.push_back(in);
                 }
-                break;
+        } while(!endsBlock(in) && count < MAX_BLOCK_LENGTH && address < 4096 - 1);
+
+        block->end = address;
+        block->count = count;
+        block->code = NULL;
+
+        for(unsigned a = start; a < address; ++a)
+        {
+                ++isCode[a];
+        }
+        blocks[start] = block;
+        return block;
+}
+
+void Chip8::retireBlocks(unsigned short address, unsigned short length)
+{ // Drops every block translated from memory in [address, address + length)
+        bool hit = false;
+        for(unsigned a = address; a < address + length && a < 4096; ++a)
+        {
+                hit |= isCode[a] != 0;
+        }
+        if(!hit)
+                return;
 
-                case 0x0055: // 0xFX55: Store V0 to VX in memory starting at address I.
+        for(unsigned i = 0; i < blocks.size(); ++i)
+        {
+                Block* block = blocks[i];
+                if(block && block->start < address + length && address < block->end)
                 {
-                        for(int i = 0; i <= ((opcode & 0x0F00) >> 8); ++i)
+                        for(unsigned a = block->start; a < block->end; ++a)
                         {
-                                memory[I + i] = V[i];
+                                --isCode[a];
                         }
-                        // On the original interpreter, when the operation is done, I = I + X + 1.
-                        I += ((opcode & 0x0F00) >> 8) + 1;
-                        pc += 2;
+                        blocks[i] = NULL;
+                        retired.push_back(block); // Might be the block that's running right now
                 }
-                break;
-                case 0x0065: // 0xFX65: Fills V0 to VX with values from memory starting at address I.
-                {
-                        for(int i = 0; i <= ((opcode & 0x0F00) >> 8); ++i)
+        }
+
+        if(jit)
+                jit->unlinkAll(); // Compiled blocks may jump straight into the ones just dropped
+}
+
+unsigned long Chip8::runBlocks(unsigned long budget)
+{ // Runs blocks back to back (translating them first if needed) until the budget is used up, returns how many instructions ran
+        unsigned long executed = 0;
+        do
+        {
+                Block* block = blocks[pc];
+                if(!block)
+                        block = translate(pc);
+
+                CHIP8_TRACE_RECORD(trace, pc, block->ops[0].opcode, I, sp, 1);
+                executed += block->count;
+#ifdef CHIP8_PROFILE
+                if(profile)
+                { // Timed one instruction at a time, which is slower but says where a block's time goes
+                        profile->recordRange(block->start, block->exit);
+                        for(unsigned i = 0; i < block->ops.size(); ++i)
                         {
-                                V[i] = memory[I + i];
+                                const Instruction& in = block->ops[i];
+                                if(i == block->ops.size() - 1)
+                                        pc = block->exit;
+                                uint64_t start = Chip8Profile::now();
+                                (this->*in.handler)(in);
+                                profile->recordKind(in.kind, Chip8Profile::now() - start);
                         }
-
-                        I += ((opcode & 0x0F00) >> 8) + 1;
-                        pc += 2;
+                        continue;
                 }
-                break;
-                default:
-                {
-                        cout << "Unkown opcode: " << hex << opcode << endl;
-                        isOn = false;
+#endif
+                const Instruction* op = &block->ops[0];
+                const Instruction* last = op + block->ops.size() - 1;
+                for(; op != last; ++op)
+                { // Body instructions don't look at pc
+                        (this->*op->handler)(*op);
                 }
-                break;
+                pc = block->exit;
+                (this->*last->handler)(*last);
+        } while(executed < budget && !(pc & 1) && pc < 0x1000 && isOn && !waiting);
+
+        for(unsigned i = 0; i < retired.size(); ++i)
+        {
+                delete retired[i];
+        }
+        retired.clear();
+
+        return executed;
+}
+
+unsigned long Chip8::runJit(unsigned long budget)
+{ // As runBlocks, with each block compiled to native code the first time it runs. Compiled blocks run on into the next one by themselves where they can
+        if(trace || profile)
+                return runBlocks(budget); // They want to see every block go by
+
+        long remaining = budget;
+        unsigned char* site = NULL; // Exit of the last block that asked to be linked to the next
+        do
+        {
+                Block* block = blocks[pc];
+                if(!block)
+                        block = translate(pc);
+                if(!block->code && !jit->compile(*this, block))
+                        site = NULL; // The code buffer started over, site went with it
+                if(site)
+                        jit->link(site, block->code);
+
+                site = jit->enter(*this, block->code, remaining);
+        } while(remaining > 0 && !(pc & 1) && pc < 0x1000 && isOn && !waiting);
+
+        for(unsigned i = 0; i < retired.size(); ++i)
+        {
+                delete retired[i];
+        }
+        retired.clear();
+
+        return budget - remaining;
+}
+
+unsigned long Chip8::runCompiled(unsigned long budget)
+{ // Runs the compiled program's blocks, and the instructions between them one at a time, until the budget is used up
+        unsigned long executed = 0;
+        do
+        {
+                const Chip8Compiled* block = pc < 4096 ? compiled[pc] : NULL;
+                if(block)
+                {
+                        block->run(*this);
+                        executed += block->count;
+                } else
+                {
+                        emulateCycle();
+                        ++executed;
                 }
+        } while(executed < budget && !(pc & 1) && isOn && !waiting);
+        return executed;
 }
 
-void Chip8::emulateCycle()
-{ // Emulates one cycle
+void Chip8::dropCompiled(unsigned short address, unsigned short length)
+{ // Compiled blocks made from memory in [address, address + length) no longer match it, the interpreter takes over there
+        bool hit = false;
+        for(unsigned a = address; a < address + length && a < 4096; ++a)
+        {
+                hit |= isCompiled[a];
+        }
+        if(!hit)
+                return;
 
-        // Fetch instruction
-        fetch();
+        for(unsigned i = 0; i < program->count; ++i)
+        {
+                const Chip8Compiled& block = program->blocks[i];
+                if(block.start < address + length && address < block.end)
+                        compiled[block.start] = NULL;
+        }
+}
 
-        // Decode and execute instruction
-        execute();
+unsigned short Chip8::getPC() const
+{ // Address of the next instruction to execute
+        return pc;
+}
 
-        // Update timers and keyboard
-        update();
+unsigned short Chip8::getOpcode() const
+{ // Opcode of the next instruction to execute
+        return at(pc) << 8 | at(pc + 1);
 }
 
 bool Chip8::getChipState()
@@ -445,6 +1279,23 @@ bool Chip8::getChipState()
         return isOn;
 }
 
+bool Chip8::isIdle() const
+{ // Waiting on FX0A, or going round a loop polling the keys, with both timers stopped, the screen up to date and no new keys latched: nothing changes until a key does
+        if(!(waiting || spinning) || delay_timer != 0 || sound_timer != 0 || gfxDirty)
+                return false;
+        return latchedKeys() == (waiting ? keysAtWait : keysAtSpin);
+}
+
+unsigned short Chip8::latchedKeys() const
+{ // The keys as of the last tick, one bit per key
+        unsigned short keys = 0;
+        for(int i = 0; i < 16; ++i)
+        {
+                keys |= key[i] << i;
+        }
+        return keys;
+}
+
 bool Chip8::getDrawFlag()
 { // Returns true if a change in VRAM is made
         return drawFlag;
@@ -455,25 +1306,50 @@ void Chip8::setDrawFlag(bool flag)
         drawFlag = flag;
 }
 
-void Chip8::loadROM(const string& fileName)
+bool Chip8::loadROM(const string& fileName)
 { // Loads rom from directory provided
-        file.open(fileName, ios::binary); // Open file in binary mode to read ROM
-        file.seekg(0, ios::beg); // Start from beginning of file
-        unsigned char* byte;
-        char* readP;
-        char read = 'F';
-        for(int i = 512; i < sizeof(memory)/sizeof(*memory); ++i)
-        { // Go through memory starting at 0x200 and fill out program
-                file.get(read); // Read one signed character
-                readP = &read; // Now have a pointer point to this character
-                byte = reinterpret_cast<unsigned char*>(readP); // Finally we tell the compiler to simply reinterpret this signed pointer char to an unsigned one instead
-                memory[i] = *byte; // Fill memory with instruction
-
-                if(file.eof())
-                { // End of file flag set, no need to continue iterating
-                        return;
-                }
+        RomImage image;
+        return image.read(fileName) && loadROM(image);
+}
+
+bool Chip8::fits(const RomImage& image, Mode machine)
+{ // Whether image fits in the program memory of machine, false with the reason on cerr if it doesn't
+        unsigned area = (machine == XOCHIP ? 0x10000 : 0x1000) - RomImage::PROGRAM_START;
+        if(image.size > area)
+        {
+                cerr << image.name << " is " << image.size << " bytes, more than the " << area << " bytes of program memory" << endl;
+                return false;
+        }
+        return true;
+}
+
+bool Chip8::loadROM(const RomImage& image)
+{ // Copies a ROM already in memory into the program area, wiping whatever was loaded before
+        if(!fits(image, (Mode) mode))
+                return false;
+
+        unsigned area = memoryMask + 1 - RomImage::PROGRAM_START;
+
+        unsigned length = image.bytes.size() < area ? image.bytes.size() : area;
+        unsigned low = 0x1000 - RomImage::PROGRAM_START; // Program bytes that go in the state's 4 KB, the rest in XO-CHIP's memory past it
+        memcpy(memory + RomImage::PROGRAM_START, &image.bytes[0], length < low ? length : low);
+        memset(memory + RomImage::PROGRAM_START + (length < low ? length : low), 0, low - (length < low ? length : low));
+        if(!upperMemory.empty())
+        {
+                unsigned high = length > low ? length - low : 0;
+                memcpy(&upperMemory[0], &image.bytes[0] + low, high);
+                memset(&upperMemory[0] + high, 0, upperMemory.size() - high);
         }
+
+        invalidateAll(); // The program area changed under the predecode cache
+        return true;
+}
+
+bool Chip8::getUnknownOpcode(unsigned short& opcode) const
+{ // True if the machine stopped on an opcode that doesn't exist, stored in opcode. getPC() is where it was
+        if(stoppedOnUnknown)
+                opcode = unknownOpcode;
+        return stoppedOnUnknown;
 }
 
 void Chip8::shutdown()
@@ -481,9 +1357,314 @@ void Chip8::shutdown()
   isOn = false;
 }
 
+void Chip8::setInput(Chip8Input* source)
+{ // Keyboard the machine reads its 16 keys from, NULL for none
+        input = source;
+}
+
+void Chip8::setAudio(Chip8Audio* sink)
+{ // Device the beep is played on, NULL for silence
+        audio = sink;
+}
+
+void Chip8::setVideo(Chip8Video* sink)
+{ // Display that receives VRAM whenever it changes, NULL for none
+        video = sink;
+}
+
+void Chip8::setTrace(Chip8Trace* buffer)
+{ // Ring buffer every executed instruction is recorded into, NULL for none. Only has an effect when built with CHIP8_TRACE
+        trace = buffer;
+}
+
+void Chip8::setProfile(Chip8Profile* counters)
+{ // Counters every executed instruction is added to, NULL for none. Only has an effect when built with CHIP8_PROFILE
+        profile = counters;
+        for(unsigned k = 0; counters && handlerNames[k].name; ++k)
+        {
+                counters->nameKind(k, handlerNames[k].name);
+        }
+}
+
+bool Chip8::setProgram(const Chip8Program* native)
+{ // Runs the ROM loaded now with blocks chip-8-aot compiled from it, NULL to go back to the engine alone. False (and nothing attached) if they were compiled from another ROM or the machine isn't plain CHIP-8
+        program = NULL;
+        compiled.clear();
+        isCompiled.clear();
+        if(!native)
+                return true;
+
+        uint64_t hash = 14695981039346656037ULL; // As RomImage::hash
+        for(unsigned i = 0; i < native->romSize && 0x200 + i < 4096; ++i)
+        {
+                hash ^= memory[0x200 + i];
+                hash *= 1099511628211ULL;
+        }
+        if(mode != CHIP8 || native->romSize > 4096 - 0x200 || hash != native->romHash)
+                return false;
+
+        compiled.resize(4096, NULL);
+        isCompiled.resize(4096, false);
+        for(unsigned i = 0; i < native->count; ++i)
+        {
+                const Chip8Compiled& block = native->blocks[i];
+                compiled[block.start] = &block;
+                for(unsigned a = block.start; a < block.end; ++a)
+                {
+                        isCompiled[a] = true;
+                }
+        }
+        program = native;
+        return true;
+}
+
+void Chip8::setSeed(unsigned seed)
+{ // Seeds CXNN, the same seed and input always replay the same way
+        rng = seed ? seed : 0x9E3779B9; // xorshift never leaves zero
+}
+
+void Chip8::saveState(Chip8State& snapshot) const
+{ // Copies the machine into snapshot with a single copy. That's all of it outside XO-CHIP, which also has upperMemory
+        snapshot = *this;
+}
+
+void Chip8::saveState(Chip8State& snapshot, vector<unsigned char>& upper) const
+{ // As above, with XO-CHIP's memory past 4 KB in upper (left empty in the other modes)
+        snapshot = *this;
+        upper = upperMemory;
+}
+
+void Chip8::restore(const Chip8State& snapshot, const vector<unsigned char>* upper)
+{ // Copies snapshot over the state. In XO-CHIP memory past 4 KB comes from upper, or starts clear without one
+        // Only forget decoded instructions where memory actually differs, so that
+        // restoring a recent snapshot keeps nearly all of the cache
+        for(int chunk = 0; chunk < 4096; chunk += 64)
+        {
+                if(memcmp(memory + chunk, snapshot.memory + chunk, 64) != 0)
+                        invalidate(chunk, 64);
+        }
+        bool modeChanged = mode != snapshot.mode;
+
+        static_cast<Chip8State&>(*this) = snapshot;
+        if(mode != XOCHIP)
+                vector<unsigned char>().swap(upperMemory);
+        else if(upper && upper->size() == UPPER_MEMORY)
+                upperMemory = *upper;
+        else
+                upperMemory.assign(UPPER_MEMORY, 0);
+
+        memoryMask = mode == XOCHIP ? 0xFFFF : 0xFFF;
+        if(modeChanged)
+                invalidateAll();
+}
+
+void Chip8::loadState(const Chip8State& snapshot)
+{ // Puts the machine back into the state of snapshot, with XO-CHIP's memory past 4 KB clear
+        restore(snapshot, NULL);
+        publishFrame(); // Show the restored screen straight away, timers or not
+}
+
+void Chip8::loadState(const Chip8State& snapshot, const vector<unsigned char>& upper)
+{ // Puts the machine back into the state saveState left in snapshot and upper
+        restore(snapshot, &upper);
+        publishFrame();
+}
+
+bool Chip8::reset(const RomImage& image, Mode machine)
+{ // Turns the machine into a fresh one in machine's mode that has just loaded image, keeping what it decoded and translated wherever memory is the same. False, with the machine untouched, if image doesn't fit
+        if(!fits(image, machine))
+                return false;
+
+        // Registers as the constructor, setMode and loadROM leave them, with memory put together in place of the old
+        Chip8State fresh;
+        fresh.I = 0;
+        fresh.pc = 0x200;
+        fresh.sp = 0;
+        fresh.delay_timer = 0;
+        fresh.sound_timer = 0;
+        fresh.rng = rng;
+        fresh.mode = machine;
+        memcpy(fresh.memory, fontset, sizeof(fontset));
+        if(machine != CHIP8)
+                memcpy(fresh.memory + BIG_FONT, bigFontset, sizeof(bigFontset));
+        unsigned low = 0x1000 - RomImage::PROGRAM_START;
+        memcpy(fresh.memory + RomImage::PROGRAM_START, &image.bytes[0], image.bytes.size() < low ? image.bytes.size() : low);
+        restore(fresh, NULL);
+        if(image.bytes.size() > low && !upperMemory.empty())
+                memcpy(&upperMemory[0], &image.bytes[0] + low, image.bytes.size() - low);
+
+        memcpy(front, gfx, sizeof(front));
+        isOn = true;
+        stoppedOnUnknown = false;
+        drawFlag = false;
+        gfxDirty = false;
+        spinning = false;
+        keysAtSpin = 0;
+        fastForwarded = 0;
+        return true;
+}
+
+// Save state file layout, all multi-byte values little-endian:
+//   "C8ST", version (4 bytes), mode (1), memory (4096, 65536 in XO-CHIP), V (16), I (2), pc (2),
+//   stack (16 x 2), sp (1), gfx (2 planes x 128 x 8), delay timer (1), sound timer (1), keys (2, one bit per key),
+//   random number generator state (4), FX0A waiting (1), keys when FX0A started waiting (2),
+//   high resolution (1), selected planes (1), user flags (16), audio pattern (16), pitch (1)
+static const char STATE_MAGIC[4] = { 'C', '8', 'S', 'T' };
+static const unsigned STATE_FIXED = 4 + 4 + 1 + 16 + 2 + 2 + 16 * 2 + 1 + 2 * Chip8Frame::PLANE_WORDS * 8 + 1 + 1 + 2 + 4 + 1 + 2 + 1 + 1 + 16 + 16 + 1;
+
+static unsigned stateMemory(unsigned mode)
+{ // Bytes of memory a save state holds
+        return mode == Chip8::XOCHIP ? 0x10000 : 4096;
+}
+
+static unsigned char* putLE(unsigned char* out, uint64_t value, int bytes)
+{
+        for(int i = 0; i < bytes; ++i)
+        {
+                *out++ = value >> (8 * i);
+        }
+        return out;
+}
+
+static const unsigned char* getLE(const unsigned char* in, uint64_t& value, int bytes)
+{
+        value = 0;
+        for(int i = 0; i < bytes; ++i)
+        {
+                value |= uint64_t(*in++) << (8 * i);
+        }
+        return in;
+}
+
+bool Chip8::saveState(const string& fileName) const
+{ // Writes the machine to fileName, returns false if the file couldn't be written
+        vector<unsigned char> buffer(STATE_FIXED + stateMemory(mode));
+        unsigned char* out = &buffer[0];
+
+        memcpy(out, STATE_MAGIC, 4);
+        out = putLE(out + 4, STATE_VERSION, 4);
+        out = putLE(out, mode, 1);
+        memcpy(out, memory, sizeof(memory));
+        if(mode == XOCHIP)
+                memcpy(out + sizeof(memory), &upperMemory[0], upperMemory.size());
+        out += stateMemory(mode);
+        memcpy(out, V, 16);
+        out += 16;
+        out = putLE(out, I, 2);
+        out = putLE(out, pc, 2);
+        for(int i = 0; i < 16; ++i)
+        {
+                out = putLE(out, stack[i], 2);
+        }
+        out = putLE(out, sp, 1);
+        for(int p = 0; p < 2; ++p)
+        {
+                for(int i = 0; i < Chip8Frame::PLANE_WORDS; ++i)
+                {
+                        out = putLE(out, gfx[p][i], 8);
+                }
+        }
+        out = putLE(out, delay_timer, 1);
+        out = putLE(out, sound_timer, 1);
+        unsigned short keys = 0;
+        for(int i = 0; i < 16; ++i)
+        {
+                keys |= (key[i] != 0) << i;
+        }
+        out = putLE(out, keys, 2);
+        out = putLE(out, rng, 4);
+        out = putLE(out, waiting, 1);
+        out = putLE(out, keysAtWait, 2);
+        out = putLE(out, hires, 1);
+        out = putLE(out, planes, 1);
+        memcpy(out, flags, 16);
+        out += 16;
+        memcpy(out, pattern, 16);
+        out += 16;
+        out = putLE(out, pitch, 1);
+
+        ofstream stateFile(fileName, ios::binary);
+        if(!stateFile.write(reinterpret_cast<const char*>(&buffer[0]), buffer.size()))
+        {
+                cerr << "Could not write save state " << fileName << endl;
+                return false;
+        }
+        return true;
+}
+
+bool Chip8::loadState(const string& fileName)
+{ // Restores the machine from fileName, leaves it untouched and returns false if the file isn't a valid save state
+        vector<unsigned char> buffer(STATE_FIXED + stateMemory(XOCHIP) + 1);
+        ifstream stateFile(fileName, ios::binary);
+        stateFile.read(reinterpret_cast<char*>(&buffer[0]), buffer.size());
+        unsigned size = stateFile.gcount();
+        if(!stateFile.eof() || size < 9 || memcmp(&buffer[0], STATE_MAGIC, 4) != 0)
+        {
+                cerr << "Not a save state: " << fileName << endl;
+                return false;
+        }
+
+        uint64_t value;
+        const unsigned char* in = getLE(&buffer[4], value, 4);
+        if(value != STATE_VERSION)
+        {
+                cerr << "Unsupported save state version " << value << " in " << fileName << endl;
+                return false;
+        }
+
+        Chip8State state;
+        in = getLE(in, value, 1); state.mode = value;
+        if(state.mode > XOCHIP || size != STATE_FIXED + stateMemory(state.mode))
+        {
+                cerr << "Not a save state: " << fileName << endl;
+                return false;
+        }
+        memcpy(state.memory, in, sizeof(state.memory));
+        vector<unsigned char> upper(in + sizeof(state.memory), in + stateMemory(state.mode));
+        in += stateMemory(state.mode);
+        memcpy(state.V, in, 16);
+        in += 16;
+        in = getLE(in, value, 2); state.I = value;
+        in = getLE(in, value, 2); state.pc = value;
+        for(int i = 0; i < 16; ++i)
+        {
+                in = getLE(in, value, 2);
+                state.stack[i] = value;
+        }
+        in = getLE(in, value, 1); state.sp = value & 0xF;
+        for(int p = 0; p < 2; ++p)
+        {
+                for(int i = 0; i < Chip8Frame::PLANE_WORDS; ++i)
+                {
+                        in = getLE(in, value, 8);
+                        state.gfx[p][i] = value;
+                }
+        }
+        in = getLE(in, value, 1); state.delay_timer = value;
+        in = getLE(in, value, 1); state.sound_timer = value;
+        in = getLE(in, value, 2);
+        for(int i = 0; i < 16; ++i)
+        {
+                state.key[i] = (value >> i) & 1;
+        }
+        in = getLE(in, value, 4); state.rng = value ? value : 0x9E3779B9;
+        in = getLE(in, value, 1); state.waiting = value != 0;
+        in = getLE(in, value, 2); state.keysAtWait = value;
+        in = getLE(in, value, 1); state.hires = value != 0;
+        in = getLE(in, value, 1); state.planes = value & 3;
+        memcpy(state.flags, in, 16);
+        in += 16;
+        memcpy(state.pattern, in, 16);
+        in += 16;
+        in = getLE(in, value, 1); state.pitch = value;
+
+        loadState(state, upper);
+        return true;
+}
+
 void Chip8::printDebug()
 {
-	cout << "OP: " << hex << opcode << endl;
+	cout << "OP: " << hex << getOpcode() << endl;
 	cout << "I: " << hex << I << endl;
 	cout << "PC: " << hex << pc << endl;
 	cout << "SP: " << hex << sp << endl << endl;
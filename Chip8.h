@@ -3,21 +3,33 @@
 #define CHIP8_H
 
 #include <iostream>
-#include <SFML/Graphics.hpp>
-#include <SFML/Audio.hpp>
 #include <vector>
+#include <array>
+#include <string>
 #include <fstream>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <time.h>
-#include <math.h>
+
+#include "Frontend.h"
+#include "Trace.h"
+#include "Profile.h"
+#include "RomList.h"
 
 using namespace std;
 
-class Chip8
+class Chip8Jit;
+struct Chip8Program;
+struct Chip8Compiled;
+
+// Everything that makes up a running machine, kept together in one plain struct
+// so that a snapshot is a single copy. The exception is XO-CHIP's memory past
+// the first 4 KB: only machines in that mode have it, so Chip8 keeps it apart
+// and the snapshots that need it carry it alongside.
+struct Chip8State
 {
-private:
-        unsigned short opcode;
-        unsigned char memory [4096] = {0};
         unsigned char V[16] = {0};
         unsigned short I;
         unsigned short pc;
@@ -25,155 +37,294 @@ private:
         unsigned short stack[16] = {0};
         unsigned short sp;
 
-        unsigned char gfx[64*32] = {0};
+        // VRAM, one 64-bit word per row with the leftmost pixel in the most significant bit
+        // (two words per row in 128x64), laid out as a Chip8Frame: XO-CHIP's second plane in gfx[1]
+        uint64_t gfx[2][Chip8Frame::PLANE_WORDS] = {{0}};
 
         unsigned char delay_timer;
         unsigned char sound_timer;
-        static const unsigned SAMPLES = 44100;
-        static const unsigned SAMPLE_RATE = 44100;
-        static const unsigned AMPLITUDE = 30000;
+        unsigned char key[16] = {0};
 
-        sf::Int16 raw[SAMPLES];
+        unsigned rng; // State of the machine's own random number generator (xorshift32)
 
-        sf::SoundBuffer Buffer;
+        // FX0A in progress: keys as they were when it started waiting for a change
+        unsigned char waiting = 0;
+        unsigned short keysAtWait = 0;
 
-        sf::Sound Sound;
+        // SUPER-CHIP and XO-CHIP
+        unsigned char mode = 0;          // Chip8::Mode
+        unsigned char hires = 0;         // 128x64 instead of 64x32 (00FF, 00FE)
+        unsigned char planes = 1;        // Bitplanes drawn, cleared and scrolled (FN01)
+        unsigned char flags[16] = {0};   // RPL user flags (FX75, FX85)
+        unsigned char pattern[16] = {0}; // Audio pattern buffer (F002)
+        unsigned char pitch = 64;        // Audio pattern playback rate (FX3A)
 
-        const double TWO_PI = 6.28318;
-        const double increment = 440./44100;
+        unsigned char memory [4096] = {0};
+};
 
-        unsigned char key[16] = {0};
-        sf::Keyboard::Key keyNum[16] =
-                {
-                        sf::Keyboard::X, sf::Keyboard::Num1, sf::Keyboard::Num2,
-                        sf::Keyboard::Num3, sf::Keyboard::Q, sf::Keyboard::W,
-                        sf::Keyboard::E, sf::Keyboard::A, sf::Keyboard::S,
-                        sf::Keyboard::D, sf::Keyboard::Z, sf::Keyboard::C,
-                        sf::Keyboard::Num4, sf::Keyboard::R, sf::Keyboard::F,
-                        sf::Keyboard::V
-                };
-
-        unsigned char fontset[80] =
-                {
-                        0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-                        0x20, 0x60, 0x20, 0x20, 0x70, // 1
-                        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-                        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-                        0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-                        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-                        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-                        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-                        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-                        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-                        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-                        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-                        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-                        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-                        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-                        0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-                };
+class Chip8 : private Chip8State
+{
+        friend class Chip8Jit;
+public:
+        enum Engine
+        {
+                INTERPRETER, // One cached instruction per dispatch
+                BLOCKS,      // Translated basic blocks of fused instructions
+                JIT          // The same blocks compiled to x86-64 and linked together
+        };
+
+        enum Mode
+        {
+                CHIP8,  // The original instruction set, 64x32
+                SCHIP,  // SUPER-CHIP 1.1: 128x64, scrolling, 16x16 sprites, big font, user flags
+                XOCHIP  // SUPER-CHIP plus 64 KB of memory, two bitplanes and the audio pattern buffer
+        };
+private:
+        // The CPU draws into gfx, frontends only ever see the last published copy in front
+        uint64_t front[2][Chip8Frame::PLANE_WORDS] = {{0}};
+
+        Chip8Input* input;
+        Chip8Audio* audio;
+        Chip8Video* video;
+
+        Chip8Trace* trace;
+        Chip8Profile* profile;
+
+        static const unsigned char fontset[80];     // The 4x5 digits every mode has, loaded at 0
+        static const unsigned char bigFontset[160]; // SUPER-CHIP's 8x10 digits, loaded at BIG_FONT
+        static const unsigned short BIG_FONT = 0x50;
+
+        unsigned memoryMask; // Addresses wrap at 4 KB, or 64 KB in XO-CHIP
+        vector<unsigned char> upperMemory; // XO-CHIP's memory from 4 KB on, empty in the other modes
+        static const unsigned UPPER_MEMORY = 0x10000 - 4096;
+        unsigned char& at(unsigned address);
+        unsigned char at(unsigned address) const;
 
         bool isOn;
-        bool drawFlag;
-
-        ifstream file;
-
-        void fetch();
-        void execute();
-        void update();
-
-        void RESET();
-        void CLEAR();
-        void RETURN();
-
-        void JUMP();
-        void SUB();
-        void SKIP_IF_VX();
-        void SKIP_IF_NOT_VX();
-        void SKIP_IF_VX_VY();
-        void SET_VX();
-        void ADD_TO_VX();
-
-        void ARITHMETIC();
-        void VX_VY();
-        void VX_OR_VY();
-        void VX_AND_VY();
-        void VX_XOR_VY();
-        void ADD_VY_VX();
-        void SUB_VY_VX();
-        void SHIFT_VX_RIGHT();
-        void SET_VX_VY_SUB_VX();
-        void SHIFT_VX_LEFT();
-
-        void SKIP_IF_VX_NOT_VY();
-        void SET_I();
-        void JUMP_ADD_V0();
-        void SET_VX_RANDOM();
-        void DRAW();
-
-        void SKIP_IF_KEY();
-        void SKIP_IF_KEY_VX();
-        void SKIP_IF_KEY_NOT_VX();
-
-        void OTHERS();
-
-
-        void (Chip8::*Chip8Table[16]) () =
-                {
-                        &Chip8::RESET,          &Chip8::JUMP,
-                        &Chip8::SUB,            &Chip8::SKIP_IF_VX,
-                        &Chip8::SKIP_IF_NOT_VX, &Chip8::SKIP_IF_VX_VY,
-                        &Chip8::SET_VX,         &Chip8::ADD_TO_VX,
-                        &Chip8::ARITHMETIC,     &Chip8::SKIP_IF_VX_NOT_VY,
-                        &Chip8::SET_I,          &Chip8::JUMP_ADD_V0,
-                        &Chip8::SET_VX_RANDOM,  &Chip8::DRAW,
-                        &Chip8::SKIP_IF_KEY,    &Chip8::OTHERS
-                };
-
-        void (Chip8::*Chip8Reset[15]) () =
-                {
-                        &Chip8::CLEAR,          NULL,
-						NULL,                   NULL,
-						NULL,                   NULL,
-						NULL,                   NULL,
-						NULL,                   NULL,
-						NULL,                   NULL,
-						NULL,                   NULL,
-						&Chip8::RETURN
-                };
-
-        void (Chip8::*Chip8Arithmetic[15]) () =
-                {
-                        &Chip8::VX_VY,             &Chip8::VX_OR_VY,
-                        &Chip8::VX_AND_VY,         &Chip8::VX_XOR_VY,
-                        &Chip8::ADD_VY_VX,         &Chip8::SUB_VY_VX,
-                        &Chip8::SHIFT_VX_RIGHT,    &Chip8::SET_VX_VY_SUB_VX,
-                        NULL,                      NULL,
-                        NULL,                      NULL,
-                        NULL,                      NULL,
-                        &Chip8::SHIFT_VX_LEFT
-                };
-
-        void (Chip8::*Chip8SkipIfKey[16]) () =
-                {
-                        NULL,                       &Chip8::SKIP_IF_KEY_NOT_VX,
-                        NULL,                       NULL,
-                        NULL,                       NULL,
-                        NULL,                       NULL,
-                        NULL,                       NULL,
-                        NULL,                       NULL,
-                        NULL,                       NULL,
-                        &Chip8::SKIP_IF_KEY_VX,     NULL
-                };
+        bool stoppedOnUnknown;       // isOn went off on an opcode that doesn't exist (at pc), which was unknownOpcode
+        unsigned short unknownOpcode;
+        bool drawFlag; // A published frame nobody has drawn yet
+        bool gfxDirty; // gfx changed since the last publish
+
+        // Last run() fast-forwarded a loop going nowhere with both timers stopped: keys when it did
+        bool spinning;
+        unsigned short keysAtSpin;
+        bool fastForward;           // spin() is allowed to skip trips round such loops
+        unsigned long fastForwarded; // Cycles run() counted without dispatching them, see getFastForwarded()
+
+        struct Instruction
+        { // An opcode with its handler resolved and its operands already extracted
+                void (Chip8::*handler) (const Instruction&);
+                unsigned short opcode;
+                unsigned short nnn;
+                unsigned char x;
+                unsigned char y;
+                unsigned char n;
+                unsigned char nn;
+#ifdef CHIP8_PROFILE
+                unsigned char kind;      // Index into handlerNames
+#endif
+        };
+
+        typedef void (Chip8::*Handler) (const Instruction&);
+
+        // Every handler once, DECODE first: it's what every invalidated cache entry holds
+#define CHIP8_HANDLERS(X) \
+        X(DECODE) X(UNKNOWN) X(CLEAR) X(RETURN) \
+        X(JUMP) X(SUB) X(SKIP_IF_VX) X(SKIP_IF_NOT_VX) \
+        X(SKIP_IF_VX_VY) X(SET_VX) X(ADD_TO_VX) \
+        X(VX_VY) X(VX_OR_VY) X(VX_AND_VY) X(VX_XOR_VY) \
+        X(ADD_VY_VX) X(SUB_VY_VX) X(SHIFT_VX_RIGHT) X(SET_VX_VY_SUB_VX) \
+        X(SHIFT_VX_LEFT) X(SKIP_IF_VX_NOT_VY) X(SET_I) X(JUMP_ADD_V0) \
+        X(SET_VX_RANDOM) X(DRAW) X(SET_I_DRAW) \
+        X(SKIP_IF_KEY_VX) X(SKIP_IF_KEY_NOT_VX) \
+        X(VX_DELAY) X(WAIT_KEY) X(SET_DELAY) X(SET_SOUND) \
+        X(ADD_VX_TO_I) X(SET_I_SPRITE) X(STORE_BCD) X(STORE_V0_VX) X(LOAD_V0_VX) \
+        X(SCROLL_DOWN) X(SCROLL_UP) X(SCROLL_RIGHT) X(SCROLL_LEFT) \
+        X(EXIT) X(LORES) X(HIRES) X(DRAW_PLANES) \
+        X(SAVE_VX_VY) X(LOAD_VX_VY) X(SET_I_LONG) X(SELECT_PLANES) \
+        X(LOAD_PATTERN) X(SET_PITCH) X(SET_I_BIG_SPRITE) X(STORE_FLAGS) X(LOAD_FLAGS)
+
+        enum Kind
+        { // Index of each handler in handlerNames
+#define CHIP8_KIND(handler) KIND_##handler,
+                CHIP8_HANDLERS(CHIP8_KIND)
+#undef CHIP8_KIND
+                KINDS
+        };
+
+        struct HandlerName
+        { // What the profiler calls each handler
+                Handler handler;
+                const char* name;
+        };
+        static const HandlerName handlerNames[KINDS + 1];
+
+        // Decode table: the kind of every 16-bit opcode in each mode, worked out at
+        // compile time (see Opcodes.cpp). Opcodes that don't exist are UNKNOWN.
+        static const array<unsigned char, 0x10000> opcodeKinds[3];
+        static constexpr unsigned char kindOf(Mode machine, unsigned op);
+        static constexpr unsigned char systemKind(Mode machine, unsigned op);
+        static constexpr unsigned char arithmeticKind(unsigned op);
+        static constexpr unsigned char miscKind(Mode machine, unsigned op);
+
+        // Predecode cache, one entry per even address. An entry whose handler is
+        // DECODE has not been decoded yet (or was overwritten since). Until a
+        // machine decodes something it points at undecoded(), shared by every
+        // machine and never written, so only machines that interpret allocate one.
+        Instruction* cache;
+        static Instruction* undecoded();
+
+        void decode(Instruction& in, unsigned short op);
+        void invalidate(unsigned short address, unsigned short length);
+        void forget(unsigned start, unsigned end);
+        void invalidateAll();
+
+        void restore(const Chip8State& snapshot, const vector<unsigned char>* upper);
+
+        void publishFrame();
+        void skip();
+        unsigned short latchedKeys() const;
+
+        static const unsigned MAX_SPIN_LENGTH = 8; // Instructions in the longest loop spin() recognises
+        static bool isSpinSafe(Handler handler);
+        unsigned long spin(unsigned long budget);
+
+        struct Block
+        { // A straight run of instructions translated once for the block engine
+                vector<Instruction> ops; // Body, with fused pairs, followed by the last instruction
+                unsigned short start;
+                unsigned short end;      // One past the last byte the block was translated from
+                unsigned short exit;     // Address of the last instruction
+                unsigned count;          // Number of CHIP-8 instructions the block stands for
+                const unsigned char* code; // Compiled by the JIT engine, NULL until then
+        };
+
+        static const unsigned MAX_BLOCK_LENGTH = 64;
+
+        Engine engine;
+        vector<Block*> blocks;        // Translated block starting at each address, if any
+        vector<unsigned char> isCode; // Number of blocks covering each address
+        vector<Block*> retired;       // Invalidated blocks, freed once nothing runs them
+        Chip8Jit* jit;                // Compiler for the JIT engine, NULL with the others
+
+        const Chip8Program* program;          // ROM compiled ahead of time, NULL if none
+        vector<const Chip8Compiled*> compiled; // Its block starting at each address, until that memory is written
+        vector<bool> isCompiled;              // Addresses some compiled block was made from
+
+        Block* translate(unsigned short start);
+        bool endsBlock(const Instruction& in);
+        void retireBlocks(unsigned short address, unsigned short length);
+        unsigned long runBlocks(unsigned long budget);
+        unsigned long runJit(unsigned long budget);
+        unsigned long runCompiled(unsigned long budget);
+        void dropCompiled(unsigned short address, unsigned short length);
+
+        void DECODE(const Instruction& in);
+        void UNKNOWN(const Instruction& in);
+
+        void CLEAR(const Instruction& in);
+        void RETURN(const Instruction& in);
+
+        void JUMP(const Instruction& in);
+        void SUB(const Instruction& in);
+        void SKIP_IF_VX(const Instruction& in);
+        void SKIP_IF_NOT_VX(const Instruction& in);
+        void SKIP_IF_VX_VY(const Instruction& in);
+        void SET_VX(const Instruction& in);
+        void ADD_TO_VX(const Instruction& in);
+
+        void VX_VY(const Instruction& in);
+        void VX_OR_VY(const Instruction& in);
+        void VX_AND_VY(const Instruction& in);
+        void VX_XOR_VY(const Instruction& in);
+        void ADD_VY_VX(const Instruction& in);
+        void SUB_VY_VX(const Instruction& in);
+        void SHIFT_VX_RIGHT(const Instruction& in);
+        void SET_VX_VY_SUB_VX(const Instruction& in);
+        void SHIFT_VX_LEFT(const Instruction& in);
+
+        void SKIP_IF_VX_NOT_VY(const Instruction& in);
+        void SET_I(const Instruction& in);
+        void JUMP_ADD_V0(const Instruction& in);
+        void SET_VX_RANDOM(const Instruction& in);
+        void DRAW(const Instruction& in);
+        void SET_I_DRAW(const Instruction& in);
+
+        void SKIP_IF_KEY_VX(const Instruction& in);
+        void SKIP_IF_KEY_NOT_VX(const Instruction& in);
+
+        void VX_DELAY(const Instruction& in);
+        void WAIT_KEY(const Instruction& in);
+        void SET_DELAY(const Instruction& in);
+        void SET_SOUND(const Instruction& in);
+        void ADD_VX_TO_I(const Instruction& in);
+        void SET_I_SPRITE(const Instruction& in);
+        void STORE_BCD(const Instruction& in);
+        void STORE_V0_VX(const Instruction& in);
+        void LOAD_V0_VX(const Instruction& in);
+
+        void SCROLL_DOWN(const Instruction& in);
+        void SCROLL_UP(const Instruction& in);
+        void SCROLL_RIGHT(const Instruction& in);
+        void SCROLL_LEFT(const Instruction& in);
+        void EXIT(const Instruction& in);
+        void LORES(const Instruction& in);
+        void HIRES(const Instruction& in);
+        void DRAW_PLANES(const Instruction& in);
+        void SAVE_VX_VY(const Instruction& in);
+        void LOAD_VX_VY(const Instruction& in);
+        void SET_I_LONG(const Instruction& in);
+        void SELECT_PLANES(const Instruction& in);
+        void LOAD_PATTERN(const Instruction& in);
+        void SET_PITCH(const Instruction& in);
+        void SET_I_BIG_SPRITE(const Instruction& in);
+        void STORE_FLAGS(const Instruction& in);
+        void LOAD_FLAGS(const Instruction& in);
 public:
         Chip8();
-        vector<unsigned char> getGFXArray();
+        ~Chip8();
+        Chip8(const Chip8&) = delete;
+        Chip8& operator=(const Chip8&) = delete;
+        Chip8Frame getFrame() const;
+        unsigned short getPC() const;
+        unsigned short getOpcode() const;
         void emulateCycle();
+        unsigned long run(unsigned long cycles);
+        void setFastForward(bool enabled);
+        unsigned long getFastForwarded() const;
+        void tickTimers();
+        void setEngine(Engine selected);
+        Engine getEngine() const;
+        void setMode(Mode machine);
+        Mode getMode() const;
+        static bool modeFromName(const string& name, Mode& machine);
         bool getChipState();
+        bool getUnknownOpcode(unsigned short& opcode) const;
+        bool isIdle() const;
         bool getDrawFlag();
         void setDrawFlag(bool flag);
-        void loadROM(const string& fileName);
+        bool loadROM(const string& fileName);
+        bool loadROM(const RomImage& image);
         void shutdown();
+        void setInput(Chip8Input* source);
+        void setAudio(Chip8Audio* sink);
+        void setVideo(Chip8Video* sink);
+        void setTrace(Chip8Trace* buffer);
+        void setProfile(Chip8Profile* counters);
+        bool setProgram(const Chip8Program* native);
+
+        void setSeed(unsigned seed);
+
+        static const unsigned STATE_VERSION = 4;
+        void saveState(Chip8State& snapshot) const;
+        void saveState(Chip8State& snapshot, vector<unsigned char>& upper) const;
+        void loadState(const Chip8State& snapshot);
+        void loadState(const Chip8State& snapshot, const vector<unsigned char>& upper);
+        static bool fits(const RomImage& image, Mode machine);
+        bool reset(const RomImage& image, Mode machine);
+        bool saveState(const string& fileName) const;
+        bool loadState(const string& fileName);
 		void printDebug();
 };
 
@@ -0,0 +1,101 @@
+#ifndef FRONTEND_H
+
+#define FRONTEND_H
+
+#include <stdint.h>
+
+// Read-only view of a finished frame. Rows are packed into words with the
+// leftmost pixel in the most significant bit, one word per row at 64 pixels
+// wide and two at 128. XO-CHIP's second bitplane follows PLANE_WORDS words
+// after the first. The view stays valid and unchanged until the machine
+// publishes its next frame.
+struct Chip8Frame
+{
+        static const int PLANE_WORDS = 128; // Enough for 64 rows of 128 pixels
+
+        const uint64_t* rows;
+        int width;  // 64, or 128 in SUPER-CHIP and XO-CHIP high resolution
+        int height; // 32 or 64
+        int planes; // 1, or 2 in XO-CHIP
+
+        int stride() const
+        { // Words per row
+                return width / 64;
+        }
+
+        // Bit p set where plane p has the pixel lit
+        unsigned color(int x, int y) const
+        {
+                unsigned c = 0;
+                for(int p = 0; p < planes; ++p)
+                {
+                        c |= ((rows[p * PLANE_WORDS + y * stride() + x / 64] >> (63 - x % 64)) & 1) << p;
+                }
+                return c;
+        }
+
+        bool pixel(int x, int y) const
+        {
+                return color(x, y) != 0;
+        }
+
+        // FNV-1a over the rows, for telling frames apart in regression runs
+        uint64_t hash() const
+        {
+                uint64_t h = 14695981039346656037ULL;
+                for(int p = 0; p < planes; ++p)
+                {
+                        for(int w = 0; w < height * stride(); ++w)
+                        {
+                                uint64_t word = rows[p * PLANE_WORDS + w];
+                                for(int b = 0; b < 8; ++b)
+                                {
+                                        h ^= (word >> (8 * b)) & 0xFF;
+                                        h *= 1099511628211ULL;
+                                }
+                        }
+                }
+                return h;
+        }
+};
+
+// Interfaces through which the Chip8 core talks to the outside world. The core
+// never touches a window, keyboard or sound device itself; a frontend (SFML,
+// headless, ...) implements these and hands them to the machine.
+
+class Chip8Input
+{
+public:
+        virtual ~Chip8Input() {}
+
+        // Returns the state of the 16 keys, bit i set while key i is held down
+        virtual unsigned short pollKeys() = 0;
+};
+
+class Chip8Audio
+{
+public:
+        virtual ~Chip8Audio() {}
+
+        // Called on every 60 Hz tick with whether the beep sounds for that tick,
+        // so a sink can gate the tone to the exact number of ticks it lasts
+        virtual void tick(bool beep) = 0;
+};
+
+// Swallows the beep, for runs without a sound device
+class NullAudio : public Chip8Audio
+{
+public:
+        void tick(bool) {}
+};
+
+class Chip8Video
+{
+public:
+        virtual ~Chip8Video() {}
+
+        // Called whenever the machine has published a new frame
+        virtual void drawFrame(const Chip8Frame& frame) = 0;
+};
+
+#endif
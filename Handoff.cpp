@@ -0,0 +1,80 @@
+#include "Handoff.h"
+#include <string.h>
+
+TripleBuffer::TripleBuffer()
+        : back(0), middle(1), front(2)
+{
+        for(int i = 0; i < 3; ++i)
+        {
+                memset(buffers[i].rows, 0, sizeof(buffers[i].rows));
+                buffers[i].width = 64;
+                buffers[i].height = 32;
+                buffers[i].planes = 1;
+        }
+}
+
+void TripleBuffer::drawFrame(const Chip8Frame& frame)
+{
+        Slot& slot = buffers[back];
+        for(int p = 0; p < frame.planes; ++p)
+        {
+                memcpy(slot.rows + p * Chip8Frame::PLANE_WORDS, frame.rows + p * Chip8Frame::PLANE_WORDS, frame.height * frame.stride() * sizeof(uint64_t));
+        }
+        slot.width = frame.width;
+        slot.height = frame.height;
+        slot.planes = frame.planes;
+
+        // Publish it and carry on with whatever was spare, stale or not
+        back = middle.exchange(back | FRESH, memory_order_acq_rel) & ~FRESH;
+}
+
+bool TripleBuffer::latest(Chip8Frame& frame)
+{
+        if(!(middle.load(memory_order_relaxed) & FRESH))
+                return false;
+
+        front = middle.exchange(front, memory_order_acq_rel) & ~FRESH;
+        const Slot& slot = buffers[front];
+        frame.rows = slot.rows;
+        frame.width = slot.width;
+        frame.height = slot.height;
+        frame.planes = slot.planes;
+        return true;
+}
+
+SharedInput::SharedInput()
+        : keys(0), events(0)
+{
+}
+
+unsigned short SharedInput::pollKeys()
+{
+        return keys.load(memory_order_relaxed);
+}
+
+void SharedInput::setKeys(unsigned short mask)
+{
+        if(keys.exchange(mask, memory_order_relaxed) != mask)
+                signal();
+}
+
+void SharedInput::signal()
+{
+        {
+                lock_guard<mutex> guard(lock);
+                ++events;
+        }
+        changed.notify_all();
+}
+
+unsigned SharedInput::getEvents()
+{
+        lock_guard<mutex> guard(lock);
+        return events;
+}
+
+void SharedInput::waitForEvent(unsigned seen)
+{
+        unique_lock<mutex> guard(lock);
+        changed.wait(guard, [&] { return events != seen; });
+}
@@ -0,0 +1,72 @@
+#ifndef HANDOFF_H
+
+#define HANDOFF_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#include "Frontend.h"
+
+using namespace std;
+
+// Hands finished frames from the emulation thread to the render thread. The
+// writer always has a buffer of its own to fill and the reader one to draw
+// from; the third sits in between and the two swap theirs with it, so neither
+// side ever waits on the other and the reader always gets the newest frame.
+class TripleBuffer : public Chip8Video
+{
+private:
+        static const unsigned FRESH = 4; // Set on middle when it holds a frame the reader hasn't taken
+
+        struct Slot
+        {
+                uint64_t rows[2 * Chip8Frame::PLANE_WORDS];
+                int width;
+                int height;
+                int planes;
+        };
+
+        Slot buffers[3];
+
+        unsigned back;          // Owned by the writer
+        atomic<unsigned> middle; // Index of the spare buffer, plus FRESH
+        unsigned front;         // Owned by the reader
+public:
+        TripleBuffer();
+
+        // Emulation thread: copies the frame out and makes it the newest one
+        void drawFrame(const Chip8Frame& frame);
+
+        // Render thread: takes the newest frame if there is one since the last call.
+        // The frame stays valid until the next call.
+        bool latest(Chip8Frame& frame);
+};
+
+// Keys written by the UI thread and read by the emulation thread at every tick.
+// Reading is a single atomic load; the emulation thread can also sleep until the
+// next key change or other event the UI thread signals.
+class SharedInput : public Chip8Input
+{
+private:
+        atomic<unsigned short> keys;
+
+        mutex lock;
+        condition_variable changed;
+        unsigned events; // Bumped under lock on every signal
+public:
+        SharedInput();
+
+        unsigned short pollKeys();
+
+        // UI thread: new state of the keys, signalled if it differs from the last one
+        void setKeys(unsigned short mask);
+        // UI thread: wakes the emulation thread for anything else (a command, closing)
+        void signal();
+
+        // Emulation thread: read before deciding to sleep, then sleep until it changes
+        unsigned getEvents();
+        void waitForEvent(unsigned seen);
+};
+
+#endif
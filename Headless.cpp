@@ -0,0 +1,171 @@
+#include "Chip8.h"
+#include "Scheduler.h"
+#include "ScriptedInput.h"
+#include "Movie.h"
+#include <chrono>
+#include <string.h>
+
+// Runs a ROM with no window, keyboard or sound device attached, in turbo mode
+// (as fast as the host allows, timers still ticking every cpuHz / 60
+// instructions), and reports how many instructions per second the core managed.
+// Keys can come from a scripted player (--script SEED) and be recorded to a movie,
+// or come from a movie, in which case the run lasts as long as the movie does.
+int main(int argc, char** argv)
+{
+        const char* rom = NULL;
+        unsigned long cycles = 10000000;
+        unsigned hz = Chip8Scheduler::DEFAULT_CPU_HZ;
+        Chip8::Engine engine = Chip8::INTERPRETER;
+        Chip8::Mode mode = Chip8::CHIP8;
+        const char* traceFile = NULL;
+        bool traceBinary = false;
+        const char* profileFile = NULL;
+        const char* loadFile = NULL;
+        const char* saveFile = NULL;
+        unsigned seed = time(NULL);
+        unsigned scriptSeed = 0;
+        const char* recordFile = NULL;
+        const char* replayFile = NULL;
+
+        for(int i = 1; i < argc; ++i)
+        {
+                if(strcmp(argv[i], "--blocks") == 0)
+                        engine = Chip8::BLOCKS;
+                else if(strcmp(argv[i], "--jit") == 0)
+                        engine = Chip8::JIT;
+                else if(strcmp(argv[i], "--hz") == 0 && i + 1 < argc)
+                        hz = strtoul(argv[++i], NULL, 10);
+                else if(strcmp(argv[i], "--mode") == 0 && i + 1 < argc && Chip8::modeFromName(argv[i + 1], mode))
+                        ++i;
+                else if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+                        traceFile = argv[++i];
+                else if(strcmp(argv[i], "--trace-binary") == 0)
+                        traceBinary = true;
+                else if(strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+                        profileFile = argv[++i];
+                else if(strcmp(argv[i], "--load-state") == 0 && i + 1 < argc)
+                        loadFile = argv[++i];
+                else if(strcmp(argv[i], "--save-state") == 0 && i + 1 < argc)
+                        saveFile = argv[++i];
+                else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+                        seed = strtoul(argv[++i], NULL, 10);
+                else if(strcmp(argv[i], "--script") == 0 && i + 1 < argc)
+                        scriptSeed = strtoul(argv[++i], NULL, 10);
+                else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+                        recordFile = argv[++i];
+                else if(strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+                        replayFile = argv[++i];
+                else if(!rom)
+                        rom = argv[i];
+                else
+                        cycles = strtoul(argv[i], NULL, 10);
+        }
+
+        if(!rom || hz == 0)
+        {
+                cerr << "Usage: " << argv[0] << " [--blocks | --jit] [--hz N] [--mode chip8|schip|xochip] [--trace FILE [--trace-binary]] [--profile FILE] [--load-state FILE] [--save-state FILE]"
+                     << " [--seed N] [--script SEED] [--record FILE | --replay FILE] <rom> [instructions]" << endl;
+                return 1;
+        }
+
+        // A movie brings the settings it was recorded with
+        Chip8Movie movie;
+        if(replayFile)
+        {
+                if(!movie.load(replayFile))
+                        return 1;
+                if(movie.romHash != Chip8Movie::hashROM(rom))
+                {
+                        cerr << replayFile << " was recorded on a different ROM" << endl;
+                        return 1;
+                }
+                seed = movie.seed;
+                hz = movie.cpuHz;
+                engine = (Chip8::Engine) movie.engine;
+                mode = (Chip8::Mode) movie.mode;
+        } else
+        {
+                movie.romHash = Chip8Movie::hashROM(rom);
+                movie.seed = seed;
+                movie.cpuHz = hz;
+                movie.engine = engine;
+                movie.mode = mode;
+        }
+
+        ScriptedInput script(scriptSeed);
+        MovieRecorder recorder(movie, scriptSeed ? &script : NULL);
+        MoviePlayer player(movie);
+        NullAudio audio;
+
+        Chip8 chip8;
+        chip8.setEngine(engine);
+        chip8.setMode(mode);
+        chip8.setSeed(seed);
+        chip8.setAudio(&audio);
+        if(replayFile)
+                chip8.setInput(&player);
+        else if(recordFile)
+                chip8.setInput(&recorder);
+        else if(scriptSeed)
+                chip8.setInput(&script);
+        if(!chip8.loadROM(rom))
+                return 1;
+        if(loadFile && !chip8.loadState(loadFile))
+                return 1;
+
+        Chip8Trace trace(20);
+        ofstream traceOut;
+        Chip8TraceWriter* traceWriter = NULL;
+        if(traceFile)
+        {
+#ifndef CHIP8_TRACE
+                cerr << "Tracing isn't compiled in, rebuild with 'make TRACE=1'" << endl;
+#endif
+                traceOut.open(traceFile, traceBinary ? ios::out | ios::binary : ios::out);
+                chip8.setTrace(&trace);
+                traceWriter = new Chip8TraceWriter(trace, traceOut, traceBinary);
+        }
+
+        // Optionally count executions and time per handler and per address
+        Chip8Profile profile;
+        if(profileFile)
+        {
+#ifndef CHIP8_PROFILE
+                cerr << "Profiling isn't compiled in, rebuild with 'make PROFILE=1'" << endl;
+#endif
+                chip8.setProfile(&profile);
+        }
+
+        Chip8Scheduler scheduler(chip8, hz);
+        scheduler.setTurbo(true);
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+        unsigned long executed = 0;
+        while((replayFile ? !player.finished() : executed < cycles) && chip8.getChipState())
+        {
+                executed += scheduler.runFrame();
+        }
+
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        if(saveFile && !chip8.saveState(saveFile))
+                return 1;
+        if(recordFile && !movie.save(recordFile))
+                return 1;
+        if(profileFile && !profile.write(profileFile))
+                return 1;
+
+        delete traceWriter;
+        if(traceFile && trace.getDropped())
+                cerr << trace.getDropped() << " trace records dropped" << endl;
+
+        unsigned short opcode;
+        if(chip8.getUnknownOpcode(opcode))
+                cerr << rom << ": unknown opcode " << hex << opcode << " at " << chip8.getPC() << endl;
+        cout << rom << ": " << dec << executed << " instructions in " << seconds << " s ("
+             << executed / seconds / 1e6 << " MIPS)" << endl;
+        if(recordFile || replayFile)
+                cout << "frame hash " << hex << chip8.getFrame().hash() << " after " << dec << movie.keys.size() << " ticks" << endl;
+        return 0;
+}
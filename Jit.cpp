@@ -0,0 +1,393 @@
+#include "Jit.h"
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Registers while compiled code runs: rbx points at the Chip8State, r12 at the
+// Chip8 (for calls back into handlers) and r13 holds the budget left, which
+// each block takes its instruction count off when entered. All three are
+// callee-saved, so handlers leave them alone.
+
+#define STATE(field) offsetof(Chip8State, field)
+
+static const unsigned char JE = 0x84, JNE = 0x85, JLE = 0x8E; // Second byte of jcc rel32
+
+Chip8Jit::Chip8Jit()
+{
+        buffer = NULL;
+        size = 0;
+        pageSize = sysconf(_SC_PAGESIZE);
+        allocate(MIN_BUFFER);
+}
+
+Chip8Jit::~Chip8Jit()
+{
+        if(buffer)
+                munmap(buffer, size);
+}
+
+bool Chip8Jit::allocate(size_t bytes)
+{ // Swaps the buffer for a new one of bytes with the entry and exits at its start. False, keeping the old one, if there's no executable memory to be had
+        void* memory = MAP_FAILED;
+#if defined(__x86_64__)
+        memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#endif
+        if(memory == MAP_FAILED)
+                return false;
+        unsigned char* old = buffer;
+        size_t oldSize = size;
+        buffer = (unsigned char*) memory;
+        size = bytes;
+        code = buffer;
+
+        // Entry: save the callee-saved registers (keeping the stack 16-byte aligned for calls), load ours and jump into the block
+        entry = reinterpret_cast<Entry>(code);
+        emit(0x53);                                     // push rbx
+        emit(0x41, 0x54);                               // push r12
+        emit(0x41, 0x55);                               // push r13
+        emit(0x41, 0x56);                               // push r14
+        emit(0x48, 0x83, 0xEC); emit(0x08);             // sub rsp, 8
+        emit(0x48, 0x89, 0xFB);                         // mov rbx, rdi
+        emit(0x49, 0x89, 0xF4);                         // mov r12, rsi
+        emit(0x49, 0x89, 0xD6);                         // mov r14, rdx
+        emit(0x4C, 0x8B, 0x2A);                         // mov r13, [rdx]
+        emit(0xFF, 0xE1);                               // jmp rcx
+
+        // Exits: hand the budget left back and return rax, a link site or NULL
+        stopped = code;
+        emit(0x31, 0xC0);                               // xor eax, eax
+        leave = code;
+        emit(0x4D, 0x89, 0x2E);                         // mov [r14], r13
+        emit(0x48, 0x83, 0xC4); emit(0x08);             // add rsp, 8
+        emit(0x41, 0x5E);                               // pop r14
+        emit(0x41, 0x5D);                               // pop r13
+        emit(0x41, 0x5C);                               // pop r12
+        emit(0x5B);                                     // pop rbx
+        emit(0xC3);                                     // ret
+        first = code;
+
+        if(!protect(buffer, buffer + size, PROT_READ | PROT_EXEC))
+        { // The host won't let memory be executed
+                munmap(buffer, size);
+                buffer = old;
+                size = oldSize;
+                return false;
+        }
+        if(old)
+                munmap(old, oldSize);
+        return true;
+}
+
+bool Chip8Jit::protect(unsigned char* from, unsigned char* to, int access)
+{ // Sets access on every page of the buffer that [from, to) touches
+        uintptr_t start = (uintptr_t) from & ~(pageSize - 1);
+        uintptr_t end = ((uintptr_t) to + pageSize - 1) & ~(pageSize - 1);
+        return mprotect((void*) start, end - start, access) == 0;
+}
+
+bool Chip8Jit::isReady() const
+{ // False on hosts that aren't x86-64 or won't hand out executable memory
+        return buffer != NULL;
+}
+
+void Chip8Jit::emit(unsigned char byte)
+{
+        *code++ = byte;
+}
+
+void Chip8Jit::emit(unsigned char a, unsigned char b)
+{
+        emit(a);
+        emit(b);
+}
+
+void Chip8Jit::emit(unsigned char a, unsigned char b, unsigned char c)
+{
+        emit(a);
+        emit(b);
+        emit(c);
+}
+
+void Chip8Jit::emit32(uint32_t value)
+{
+        memcpy(code, &value, 4);
+        code += 4;
+}
+
+void Chip8Jit::emit64(uint64_t value)
+{
+        memcpy(code, &value, 8);
+        code += 8;
+}
+
+void Chip8Jit::emitState(unsigned char op, unsigned char reg, size_t offset)
+{ // ModRM [rbx + disp32] with reg (or the opcode extension) in the middle
+        emit(op, 0x80 | reg << 3 | 3);
+        emit32(offset);
+}
+
+void Chip8Jit::emitJump(unsigned char* target)
+{
+        emit(0xE9);
+        unsigned char* rel = code;
+        emit32(0);
+        patch(rel, target);
+}
+
+unsigned char* Chip8Jit::emitBranch(unsigned char condition)
+{
+        emit(0x0F, condition);
+        unsigned char* rel = code;
+        emit32(0);
+        return rel;
+}
+
+void Chip8Jit::patch(unsigned char* rel, const unsigned char* target)
+{ // Points the rel32 at rel to target
+        int32_t distance = target - (rel + 4);
+        memcpy(rel, &distance, 4);
+}
+
+void Chip8Jit::call(Chip8* chip, const Instruction* in)
+{ // What compiled code calls for instructions it doesn't do itself
+        (chip->*in->handler)(*in);
+}
+
+bool Chip8Jit::compileNative(const Instruction& in)
+{ // Emits an instruction that doesn't touch pc inline, returns false if it has to be called instead
+        const size_t VX = STATE(V) + in.x, VY = STATE(V) + in.y, VF = STATE(V) + 0xF;
+        Chip8::Handler h = in.handler;
+        if(h == &Chip8::SET_VX)
+        {
+                emitState(0xC6, 0, VX); emit(in.nn);    // mov byte [VX], NN
+        } else if(h == &Chip8::ADD_TO_VX)
+        {
+                emitState(0x80, 0, VX); emit(in.nn);    // add byte [VX], NN
+        } else if(h == &Chip8::VX_VY)
+        {
+                emitState(0x8A, 0, VY);                 // mov al, [VY]
+                emitState(0x88, 0, VX);                 // mov [VX], al
+        } else if(h == &Chip8::VX_OR_VY || h == &Chip8::VX_AND_VY || h == &Chip8::VX_XOR_VY)
+        {
+                emitState(0x8A, 0, VX);                 // mov al, [VX]
+                emitState(h == &Chip8::VX_OR_VY ? 0x0A : h == &Chip8::VX_AND_VY ? 0x22 : 0x32, 0, VY); // or/and/xor al, [VY]
+                emitState(0x88, 0, VX);                 // mov [VX], al
+                if(h == &Chip8::VX_OR_VY)
+                {
+                        emitState(0xC6, 0, VF); emit(0); // mov byte [VF], 0
+                }
+        } else if(h == &Chip8::ADD_VY_VX || h == &Chip8::SUB_VY_VX || h == &Chip8::SET_VX_VY_SUB_VX)
+        { // The flag comes from the old values, then the result is worked out again in case X or Y is F
+                unsigned char op = h == &Chip8::ADD_VY_VX ? 0x02 : 0x2A;             // add/sub al, [..]
+                size_t left = h == &Chip8::SET_VX_VY_SUB_VX ? VY : VX;
+                size_t right = h == &Chip8::SET_VX_VY_SUB_VX ? VX : VY;
+                emitState(0x8A, 0, left);               // mov al, [left]
+                emitState(op, 0, right);                // add/sub al, [right]
+                emit(0x0F, h == &Chip8::ADD_VY_VX ? 0x92 : 0x93, 0xC1); // setc cl (carry) or setnc cl (no borrow)
+                emitState(0x88, 1, VF);                 // mov [VF], cl
+                emitState(0x8A, 0, left);
+                emitState(op, 0, right);
+                emitState(0x88, 0, VX);                 // mov [VX], al
+        } else if(h == &Chip8::SHIFT_VX_RIGHT)
+        {
+                emitState(0x8A, 0, VX);                 // mov al, [VX]
+                emit(0x24, 0x01);                       // and al, 1
+                emitState(0x88, 0, VF);                 // mov [VF], al
+                emitState(0xD0, 5, VX);                 // shr byte [VX], 1
+        } else if(h == &Chip8::SHIFT_VX_LEFT)
+        {
+                emitState(0x8A, 0, VX);                 // mov al, [VX]
+                emit(0xC0, 0xE8, 0x07);                 // shr al, 7
+                emitState(0x88, 0, VF);                 // mov [VF], al
+                emitState(0xD0, 4, VX);                 // shl byte [VX], 1
+        } else if(h == &Chip8::SET_I)
+        {
+                emit(0x66); emitState(0xC7, 0, STATE(I)); emit(in.nnn & 0xFF, in.nnn >> 8); // mov word [I], NNN
+        } else if(h == &Chip8::ADD_VX_TO_I)
+        {
+                emit(0x0F); emitState(0xB7, 0, STATE(I)); // movzx eax, word [I]
+                emit(0x0F); emitState(0xB6, 1, VX);     // movzx ecx, byte [VX]
+                emit(0x01, 0xC8);                       // add eax, ecx
+                emit(0x3D); emit32(0xFFF);              // cmp eax, 0xFFF
+                emit(0x0F, 0x97, 0xC2);                 // seta dl
+                emitState(0x88, 2, VF);                 // mov [VF], dl
+                emit(0x0F); emitState(0xB6, 1, VX);     // movzx ecx, byte [VX]
+                emit(0x66); emitState(0x01, 1, STATE(I)); // add [I], cx
+        } else if(h == &Chip8::SET_I_SPRITE)
+        {
+                emit(0x0F); emitState(0xB6, 0, VX);     // movzx eax, byte [VX]
+                emit(0x8D, 0x04, 0x80);                 // lea eax, [rax + rax * 4]
+                emit(0x66); emitState(0x89, 0, STATE(I)); // mov [I], ax
+        } else if(h == &Chip8::VX_DELAY)
+        {
+                emitState(0x8A, 0, STATE(delay_timer)); // mov al, [delay_timer]
+                emitState(0x88, 0, VX);                 // mov [VX], al
+        } else if(h == &Chip8::SET_DELAY || h == &Chip8::SET_SOUND)
+        {
+                emitState(0x8A, 0, VX);                 // mov al, [VX]
+                emitState(0x88, 0, h == &Chip8::SET_DELAY ? STATE(delay_timer) : STATE(sound_timer));
+        } else
+        {
+                return false;
+        }
+        return true;
+}
+
+void Chip8Jit::compileCall(const Instruction& in)
+{ // Runs the instruction's handler, as the block engine would
+        emit(0x4C, 0x89, 0xE7);                         // mov rdi, r12
+        emit(0x48, 0xBE); emit64((uintptr_t) &in);      // mov rsi, &in
+        emit(0x48, 0xB8); emit64((uintptr_t) &call);    // mov rax, call
+        emit(0xFF, 0xD0);                               // call rax
+}
+
+void Chip8Jit::compileExit(unsigned target)
+{ // Leaves the block for target, through a jump that link() can point straight at the block there
+        emit(0x66); emitState(0xC7, 0, STATE(pc)); emit(target & 0xFF, target >> 8); // mov word [pc], target
+        if((target & 1) || target >= 0x1000)
+        { // Never a block of its own, the dispatch loop sorts it out
+                emitJump(stopped);
+                return;
+        }
+
+        emit(0x4D, 0x85, 0xED);                         // test r13, r13
+        patch(emitBranch(JLE), stopped);                // Budget used up
+        unsigned char* site = code;
+        emit(0xE9); emit32(0);                          // jmp next, or the linked block
+        emit(0x48, 0x8D, 0x05);                         // lea rax, [site]
+        unsigned char* rel = code;
+        emit32(0);
+        patch(rel, site);
+        emitJump(leave);
+}
+
+unsigned char* Chip8Jit::compileSkip(const Instruction& in)
+{ // Emits the comparison and a branch for when there's nothing to skip, returns its rel32 (NULL if in isn't a skip)
+        const size_t VX = STATE(V) + in.x, VY = STATE(V) + in.y;
+        Chip8::Handler h = in.handler;
+        unsigned char notTaken;
+        if(h == &Chip8::SKIP_IF_VX || h == &Chip8::SKIP_IF_NOT_VX)
+        {
+                emitState(0x80, 7, VX); emit(in.nn);    // cmp byte [VX], NN
+                notTaken = h == &Chip8::SKIP_IF_VX ? JNE : JE;
+        } else if(h == &Chip8::SKIP_IF_VX_VY || h == &Chip8::SKIP_IF_VX_NOT_VY)
+        {
+                emitState(0x8A, 0, VX);                 // mov al, [VX]
+                emitState(0x3A, 0, VY);                 // cmp al, [VY]
+                notTaken = h == &Chip8::SKIP_IF_VX_VY ? JNE : JE;
+        } else if(h == &Chip8::SKIP_IF_KEY_VX || h == &Chip8::SKIP_IF_KEY_NOT_VX)
+        {
+                emit(0x0F); emitState(0xB6, 0, VX);     // movzx eax, byte [VX]
+                emit(0x83, 0xE0, 0x0F);                 // and eax, 15
+                emit(0x80, 0xBC, 0x03); emit32(STATE(key)); emit(0); // cmp byte [rbx + rax + key], 0
+                notTaken = h == &Chip8::SKIP_IF_KEY_VX ? JE : JNE;
+        } else
+        {
+                return NULL;
+        }
+        return emitBranch(notTaken);
+}
+
+bool Chip8Jit::compile(Chip8& chip, Block* block)
+{ // Compiles a translated block, returns false if the buffer had to be emptied first (which drops every link made so far)
+        bool kept = true;
+        if(code + MAX_BLOCK_CODE > buffer + size)
+        { // Start over, in a bigger buffer while there's room to grow. Nothing compiled can be running while the dispatch loop calls this
+                if(size >= MAX_BUFFER || !allocate(size * 2))
+                        code = first;
+                links.clear();
+                for(unsigned i = 0; i < chip.blocks.size(); ++i)
+                {
+                        if(chip.blocks[i])
+                                chip.blocks[i]->code = NULL;
+                }
+                kept = false;
+        }
+
+        unsigned char* start = code;
+        protect(start, start + MAX_BLOCK_CODE, PROT_READ | PROT_WRITE);
+        block->code = code;
+        emit(0x49, 0x81, 0xED); emit32(block->count);  // sub r13, count
+
+        const Instruction* op = &block->ops[0];
+        const Instruction* last = op + block->ops.size() - 1;
+        for(; op != last; ++op)
+        {
+                if(!compileNative(*op))
+                        compileCall(*op);
+        }
+
+        const unsigned exit = block->exit;
+        Chip8::Handler h = last->handler;
+        unsigned char* over;
+        if(h == &Chip8::JUMP)
+        {
+                compileExit(last->nnn);
+        } else if(h == &Chip8::SUB)
+        {
+                emit(0x0F); emitState(0xB7, 0, STATE(sp));      // movzx eax, word [sp]
+                emit(0x66, 0xC7, 0x84); emit(0x43); emit32(STATE(stack)); emit(exit & 0xFF, exit >> 8); // mov word [rbx + rax * 2 + stack], exit
+                emit(0xFF, 0xC0);                               // inc eax
+                emit(0x83, 0xE0, 0x0F);                         // and eax, 15
+                emit(0x66); emitState(0x89, 0, STATE(sp));      // mov [sp], ax
+                compileExit(last->nnn);
+        } else if(h == &Chip8::RETURN)
+        {
+                emit(0x0F); emitState(0xB7, 0, STATE(sp));      // movzx eax, word [sp]
+                emit(0xFF, 0xC8);                               // dec eax
+                emit(0x83, 0xE0, 0x0F);                         // and eax, 15
+                emit(0x66); emitState(0x89, 0, STATE(sp));      // mov [sp], ax
+                emit(0x0F, 0xB7, 0x84); emit(0x43); emit32(STATE(stack)); // movzx eax, word [rbx + rax * 2 + stack]
+                emit(0x83, 0xC0, 0x02);                         // add eax, 2
+                emit(0x66); emitState(0x89, 0, STATE(pc));      // mov [pc], ax
+                emitJump(stopped);
+        } else if(h == &Chip8::JUMP_ADD_V0)
+        {
+                emit(0x0F); emitState(0xB6, 0, STATE(V));       // movzx eax, byte [V0]
+                emit(0x05); emit32(last->nnn);                  // add eax, NNN
+                emit(0x25); emit32(0xFFF);                      // and eax, 0xFFF
+                emit(0x66); emitState(0x89, 0, STATE(pc));      // mov [pc], ax
+                emitJump(stopped);
+        } else if(chip.mode != Chip8::XOCHIP && (over = compileSkip(*last)))
+        { // XO-CHIP skips have to look at what they skip over, so they're called instead
+                compileExit(exit + 4);
+                patch(over, code);
+                compileExit(exit + 2);
+        } else if(compileNative(*last))
+        { // The block was cut off at its maximum length
+                compileExit(exit + 2);
+        } else
+        {
+                emit(0x66); emitState(0xC7, 0, STATE(pc)); emit(exit & 0xFF, exit >> 8); // mov word [pc], exit
+                compileCall(*last);
+                emitJump(stopped);
+        }
+        protect(start, start + MAX_BLOCK_CODE, PROT_READ | PROT_EXEC);
+        return kept;
+}
+
+unsigned char* Chip8Jit::enter(Chip8& chip, const unsigned char* block, long& remaining)
+{ // Runs compiled code from block until it leaves, returns the exit to link to the next block, if any
+        return entry(static_cast<Chip8State*>(&chip), &chip, &remaining, block);
+}
+
+void Chip8Jit::link(unsigned char* site, const unsigned char* block)
+{ // Makes the exit at site jump straight into block from now on
+        protect(site, site + 5, PROT_READ | PROT_WRITE);
+        patch(site + 1, block);
+        protect(site, site + 5, PROT_READ | PROT_EXEC);
+        links.push_back(site);
+}
+
+void Chip8Jit::unlinkAll()
+{ // Points every linked exit back at the dispatch loop, when blocks they might jump to are gone
+        if(links.empty())
+                return;
+        protect(first, code, PROT_READ | PROT_WRITE);
+        for(unsigned i = 0; i < links.size(); ++i)
+        {
+                patch(links[i] + 1, links[i] + 5);
+        }
+        protect(first, code, PROT_READ | PROT_EXEC);
+        links.clear();
+}
@@ -0,0 +1,74 @@
+#ifndef JIT_H
+
+#define JIT_H
+
+#include "Chip8.h"
+
+// Compiles the blocks of the block engine to x86-64 machine code, for Chip8's
+// JIT engine. The machine's state stays in memory behind a pinned register and
+// the simple instructions (registers, arithmetic, I, timers, jumps, calls and
+// skips) are compiled inline; everything else calls back into the handler the
+// block engine would have run. A block whose next address is known jumps
+// straight into the next block once that one is compiled, as long as budget is
+// left, so tight loops never come back out to C++. Any write over translated
+// code unlinks every block again. Code lives in one buffer that is thrown away
+// as a whole when it fills up. The buffer is never writable and executable at
+// once: it's writable only while compile() or a patch is writing it. It starts
+// small and each time it fills up is swapped for one twice the size (up to
+// MAX_BUFFER), so machines running small ROMs only map what they use.
+class Chip8Jit
+{
+private:
+        typedef Chip8::Block Block;
+        typedef Chip8::Instruction Instruction;
+
+        // Enters compiled code: (state, machine, remaining budget, block code), returns a link site or NULL
+        typedef unsigned char* (*Entry) (Chip8State*, Chip8*, long*, const unsigned char*);
+
+        static const size_t MIN_BUFFER = 64 << 10;
+        static const size_t MAX_BUFFER = 4 << 20;
+        static const size_t MAX_BLOCK_CODE = 4096; // More than a block of MAX_BLOCK_LENGTH instructions compiles to
+
+        unsigned char* buffer;
+        size_t size;
+        size_t pageSize;
+        unsigned char* code;            // Where the next block goes
+        unsigned char* stopped;         // Shared exits back to C++: with no block to link
+        unsigned char* leave;           // and with the link site in rax
+        unsigned char* first;           // Where compiled blocks start
+        Entry entry;
+        vector<unsigned char*> links;   // Exits currently jumping straight into another block
+
+        bool allocate(size_t bytes);
+        bool protect(unsigned char* from, unsigned char* to, int access);
+
+        void emit(unsigned char byte);
+        void emit(unsigned char a, unsigned char b);
+        void emit(unsigned char a, unsigned char b, unsigned char c);
+        void emit32(uint32_t value);
+        void emit64(uint64_t value);
+        void emitState(unsigned char op, unsigned char reg, size_t offset); // op reg, [state + offset]
+        void emitJump(unsigned char* target);                               // jmp rel32
+        unsigned char* emitBranch(unsigned char condition);                 // jcc rel32, returns the rel32 to patch
+        void patch(unsigned char* rel, const unsigned char* target);
+
+        bool compileNative(const Instruction& in);
+        void compileCall(const Instruction& in);
+        void compileExit(unsigned target);
+        unsigned char* compileSkip(const Instruction& in);
+
+        static void call(Chip8* chip, const Instruction* in);
+public:
+        Chip8Jit();
+        ~Chip8Jit();
+        Chip8Jit(const Chip8Jit&) = delete;
+        Chip8Jit& operator=(const Chip8Jit&) = delete;
+
+        bool isReady() const;
+        bool compile(Chip8& chip, Block* block);
+        unsigned char* enter(Chip8& chip, const unsigned char* block, long& remaining);
+        void link(unsigned char* site, const unsigned char* block);
+        void unlinkAll();
+};
+
+#endif
@@ -0,0 +1,778 @@
+#include "Lockstep.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Vector helpers over one row of 32 byte lanes (Bytes) and over 32 word lanes
+// stored as plain arrays. Masks are Bytes with 0xFF in selected lanes.
+#if defined(__AVX2__)
+
+typedef __m256i Bytes;
+
+static inline Bytes loadBytes(const unsigned char* p) { return _mm256_loadu_si256((const __m256i*) p); }
+static inline void storeBytes(unsigned char* p, Bytes a) { _mm256_storeu_si256((__m256i*) p, a); }
+static inline Bytes splat(unsigned char v) { return _mm256_set1_epi8((char) v); }
+static inline Bytes add(Bytes a, Bytes b) { return _mm256_add_epi8(a, b); }
+static inline Bytes sub(Bytes a, Bytes b) { return _mm256_sub_epi8(a, b); }
+static inline Bytes bitAnd(Bytes a, Bytes b) { return _mm256_and_si256(a, b); }
+static inline Bytes bitOr(Bytes a, Bytes b) { return _mm256_or_si256(a, b); }
+static inline Bytes bitXor(Bytes a, Bytes b) { return _mm256_xor_si256(a, b); }
+static inline Bytes andNot(Bytes a, Bytes b) { return _mm256_andnot_si256(a, b); } // ~a & b
+static inline Bytes equal(Bytes a, Bytes b) { return _mm256_cmpeq_epi8(a, b); }
+static inline Bytes maxBytes(Bytes a, Bytes b) { return _mm256_max_epu8(a, b); }
+static inline Bytes subSaturate(Bytes a, Bytes b) { return _mm256_subs_epu8(a, b); }
+static inline Bytes shiftRight(Bytes a, int n) { return _mm256_and_si256(_mm256_srli_epi16(a, n), splat(0xFF >> n)); }
+static inline Bytes blend(Bytes mask, Bytes a, Bytes b) { return _mm256_blendv_epi8(b, a, mask); } // mask ? a : b
+static inline uint32_t laneBits(Bytes mask) { return _mm256_movemask_epi8(mask); }
+
+static inline Bytes wordsEqual(const unsigned short* w, unsigned short v)
+{
+        __m256i s = _mm256_set1_epi16(v);
+        __m256i lo = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*) w), s);
+        __m256i hi = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*) (w + 16)), s);
+        return _mm256_permute4x64_epi64(_mm256_packs_epi16(lo, hi), 0xD8); // packs works per 128-bit half
+}
+
+static inline void setWords(unsigned short* w, Bytes mask, unsigned short v)
+{
+        __m256i s = _mm256_set1_epi16(v);
+        for(int half = 0; half < 2; ++half)
+        {
+                __m256i m = _mm256_cvtepi8_epi16(half ? _mm256_extracti128_si256(mask, 1) : _mm256_castsi256_si128(mask));
+                __m256i* p = (__m256i*) (w + 16 * half);
+                _mm256_storeu_si256(p, _mm256_blendv_epi8(_mm256_loadu_si256(p), s, m));
+        }
+}
+
+static inline void decrementWords(unsigned short* w, Bytes mask)
+{ // Selected lanes are all ones, that is -1
+        for(int half = 0; half < 2; ++half)
+        {
+                __m256i m = _mm256_cvtepi8_epi16(half ? _mm256_extracti128_si256(mask, 1) : _mm256_castsi256_si128(mask));
+                __m256i* p = (__m256i*) (w + 16 * half);
+                _mm256_storeu_si256(p, _mm256_add_epi16(_mm256_loadu_si256(p), m));
+        }
+}
+
+#elif defined(__SSE2__)
+
+struct Bytes { __m128i lo, hi; };
+
+static inline Bytes halves(__m128i lo, __m128i hi) { Bytes r = { lo, hi }; return r; }
+static inline Bytes loadBytes(const unsigned char* p) { return halves(_mm_loadu_si128((const __m128i*) p), _mm_loadu_si128((const __m128i*) (p + 16))); }
+static inline void storeBytes(unsigned char* p, Bytes a) { _mm_storeu_si128((__m128i*) p, a.lo); _mm_storeu_si128((__m128i*) (p + 16), a.hi); }
+static inline Bytes splat(unsigned char v) { __m128i s = _mm_set1_epi8((char) v); return halves(s, s); }
+static inline Bytes add(Bytes a, Bytes b) { return halves(_mm_add_epi8(a.lo, b.lo), _mm_add_epi8(a.hi, b.hi)); }
+static inline Bytes sub(Bytes a, Bytes b) { return halves(_mm_sub_epi8(a.lo, b.lo), _mm_sub_epi8(a.hi, b.hi)); }
+static inline Bytes bitAnd(Bytes a, Bytes b) { return halves(_mm_and_si128(a.lo, b.lo), _mm_and_si128(a.hi, b.hi)); }
+static inline Bytes bitOr(Bytes a, Bytes b) { return halves(_mm_or_si128(a.lo, b.lo), _mm_or_si128(a.hi, b.hi)); }
+static inline Bytes bitXor(Bytes a, Bytes b) { return halves(_mm_xor_si128(a.lo, b.lo), _mm_xor_si128(a.hi, b.hi)); }
+static inline Bytes andNot(Bytes a, Bytes b) { return halves(_mm_andnot_si128(a.lo, b.lo), _mm_andnot_si128(a.hi, b.hi)); }
+static inline Bytes equal(Bytes a, Bytes b) { return halves(_mm_cmpeq_epi8(a.lo, b.lo), _mm_cmpeq_epi8(a.hi, b.hi)); }
+static inline Bytes maxBytes(Bytes a, Bytes b) { return halves(_mm_max_epu8(a.lo, b.lo), _mm_max_epu8(a.hi, b.hi)); }
+static inline Bytes subSaturate(Bytes a, Bytes b) { return halves(_mm_subs_epu8(a.lo, b.lo), _mm_subs_epu8(a.hi, b.hi)); }
+static inline Bytes shiftRight(Bytes a, int n) { return bitAnd(halves(_mm_srli_epi16(a.lo, n), _mm_srli_epi16(a.hi, n)), splat(0xFF >> n)); }
+static inline Bytes blend(Bytes mask, Bytes a, Bytes b) { return bitOr(bitAnd(mask, a), andNot(mask, b)); }
+static inline uint32_t laneBits(Bytes mask) { return _mm_movemask_epi8(mask.lo) | _mm_movemask_epi8(mask.hi) << 16; }
+
+static inline Bytes wordsEqual(const unsigned short* w, unsigned short v)
+{
+        __m128i s = _mm_set1_epi16(v);
+        __m128i q[4];
+        for(int i = 0; i < 4; ++i)
+        {
+                q[i] = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*) (w + 8 * i)), s);
+        }
+        return halves(_mm_packs_epi16(q[0], q[1]), _mm_packs_epi16(q[2], q[3]));
+}
+
+static inline void setWords(unsigned short* w, Bytes mask, unsigned short v)
+{
+        __m128i s = _mm_set1_epi16(v);
+        for(int i = 0; i < 4; ++i)
+        {
+                __m128i half = i < 2 ? mask.lo : mask.hi;
+                __m128i m = (i & 1) ? _mm_unpackhi_epi8(half, half) : _mm_unpacklo_epi8(half, half);
+                __m128i* p = (__m128i*) (w + 8 * i);
+                __m128i old = _mm_loadu_si128(p);
+                _mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(m, s), _mm_andnot_si128(m, old)));
+        }
+}
+
+static inline void decrementWords(unsigned short* w, Bytes mask)
+{ // Selected lanes are all ones, that is -1
+        for(int i = 0; i < 4; ++i)
+        {
+                __m128i half = i < 2 ? mask.lo : mask.hi;
+                __m128i m = (i & 1) ? _mm_unpackhi_epi8(half, half) : _mm_unpacklo_epi8(half, half);
+                __m128i* p = (__m128i*) (w + 8 * i);
+                _mm_storeu_si128(p, _mm_add_epi16(_mm_loadu_si128(p), m));
+        }
+}
+
+#else // Plain loops for anything else, the compiler may still vectorize them
+
+struct Bytes { unsigned char b[32]; };
+
+#define LANEWISE(expression) Bytes r; for(int l = 0; l < 32; ++l) r.b[l] = (expression); return r;
+static inline Bytes loadBytes(const unsigned char* p) { Bytes r; memcpy(r.b, p, 32); return r; }
+static inline void storeBytes(unsigned char* p, Bytes a) { memcpy(p, a.b, 32); }
+static inline Bytes splat(unsigned char v) { LANEWISE(v) }
+static inline Bytes add(Bytes a, Bytes b) { LANEWISE(a.b[l] + b.b[l]) }
+static inline Bytes sub(Bytes a, Bytes b) { LANEWISE(a.b[l] - b.b[l]) }
+static inline Bytes bitAnd(Bytes a, Bytes b) { LANEWISE(a.b[l] & b.b[l]) }
+static inline Bytes bitOr(Bytes a, Bytes b) { LANEWISE(a.b[l] | b.b[l]) }
+static inline Bytes bitXor(Bytes a, Bytes b) { LANEWISE(a.b[l] ^ b.b[l]) }
+static inline Bytes andNot(Bytes a, Bytes b) { LANEWISE(~a.b[l] & b.b[l]) }
+static inline Bytes equal(Bytes a, Bytes b) { LANEWISE(a.b[l] == b.b[l] ? 0xFF : 0) }
+static inline Bytes maxBytes(Bytes a, Bytes b) { LANEWISE(a.b[l] > b.b[l] ? a.b[l] : b.b[l]) }
+static inline Bytes subSaturate(Bytes a, Bytes b) { LANEWISE(a.b[l] > b.b[l] ? a.b[l] - b.b[l] : 0) }
+static inline Bytes shiftRight(Bytes a, int n) { LANEWISE(a.b[l] >> n) }
+static inline Bytes blend(Bytes mask, Bytes a, Bytes b) { LANEWISE(mask.b[l] ? a.b[l] : b.b[l]) }
+static inline Bytes wordsEqual(const unsigned short* w, unsigned short v) { LANEWISE(w[l] == v ? 0xFF : 0) }
+#undef LANEWISE
+
+static inline uint32_t laneBits(Bytes mask)
+{
+        uint32_t bits = 0;
+        for(int l = 0; l < 32; ++l)
+                bits |= (uint32_t) (mask.b[l] >> 7) << l;
+        return bits;
+}
+
+static inline void setWords(unsigned short* w, Bytes mask, unsigned short v)
+{
+        for(int l = 0; l < 32; ++l)
+                w[l] = mask.b[l] ? v : w[l];
+}
+
+static inline void decrementWords(unsigned short* w, Bytes mask)
+{
+        for(int l = 0; l < 32; ++l)
+                w[l] -= mask.b[l] & 1;
+}
+
+#endif
+
+// What a lane does with an opcode, the same split as Chip8::decode
+enum LaneOp
+{
+        OP_CLEAR, OP_RETURN, OP_JUMP, OP_CALL, OP_SE, OP_SNE, OP_SE_XY, OP_SET, OP_ADD,
+        OP_MOV, OP_OR, OP_AND, OP_XOR, OP_ADD_XY, OP_SUB_XY, OP_SHR, OP_SUBN_XY, OP_SHL,
+        OP_SNE_XY, OP_SET_I, OP_JUMP_V0, OP_RANDOM, OP_DRAW, OP_SKP, OP_SKNP,
+        OP_GET_DELAY, OP_WAIT_KEY, OP_SET_DELAY, OP_SET_SOUND, OP_ADD_I, OP_SPRITE,
+        OP_BCD, OP_STORE, OP_LOAD, OP_UNKNOWN
+};
+
+static LaneOp classify(unsigned short op)
+{
+        switch(op >> 12)
+        {
+        case 0x0:
+                return op == 0x00E0 ? OP_CLEAR : op == 0x00EE ? OP_RETURN : OP_UNKNOWN;
+        case 0x1: return OP_JUMP;
+        case 0x2: return OP_CALL;
+        case 0x3: return OP_SE;
+        case 0x4: return OP_SNE;
+        case 0x5: return OP_SE_XY;
+        case 0x6: return OP_SET;
+        case 0x7: return OP_ADD;
+        case 0x8:
+                switch(op & 0xF)
+                {
+                case 0x0: return OP_MOV;
+                case 0x1: return OP_OR;
+                case 0x2: return OP_AND;
+                case 0x3: return OP_XOR;
+                case 0x4: return OP_ADD_XY;
+                case 0x5: return OP_SUB_XY;
+                case 0x6: return OP_SHR;
+                case 0x7: return OP_SUBN_XY;
+                case 0xE: return OP_SHL;
+                default: return OP_UNKNOWN;
+                }
+        case 0x9: return OP_SNE_XY;
+        case 0xA: return OP_SET_I;
+        case 0xB: return OP_JUMP_V0;
+        case 0xC: return OP_RANDOM;
+        case 0xD: return OP_DRAW;
+        case 0xE:
+                return (op & 0xFF) == 0x9E ? OP_SKP : (op & 0xFF) == 0xA1 ? OP_SKNP : OP_UNKNOWN;
+        default:
+                switch(op & 0xFF)
+                {
+                case 0x07: return OP_GET_DELAY;
+                case 0x0A: return OP_WAIT_KEY;
+                case 0x15: return OP_SET_DELAY;
+                case 0x18: return OP_SET_SOUND;
+                case 0x1E: return OP_ADD_I;
+                case 0x29: return OP_SPRITE;
+                case 0x33: return OP_BCD;
+                case 0x55: return OP_STORE;
+                case 0x65: return OP_LOAD;
+                default: return OP_UNKNOWN;
+                }
+        }
+}
+
+Chip8Lockstep::Chip8Lockstep(unsigned laneCount, unsigned hz)
+{
+        lanes = laneCount < 1 ? 1 : laneCount > MAX_LANES ? MAX_LANES : laneCount;
+        cpuHz = hz;
+        credit = 0;
+
+        memset(memory, 0, sizeof(memory));
+        memset(V, 0, sizeof(V));
+        memset(I, 0, sizeof(I));
+        memset(pc, 0, sizeof(pc));
+        memset(stack, 0, sizeof(stack));
+        memset(sp, 0, sizeof(sp));
+        memset(delay_timer, 0, sizeof(delay_timer));
+        memset(sound_timer, 0, sizeof(sound_timer));
+        memset(remaining, 0, sizeof(remaining));
+        memset(gfx, 0, sizeof(gfx));
+        memset(front, 0, sizeof(front));
+        memset(keys, 0, sizeof(keys));
+
+        for(unsigned l = 0; l < MAX_LANES; ++l)
+        {
+                input[l] = NULL;
+                scalar[l] = NULL;
+                setSeed(l, time(NULL) + l);
+                executed[l] = 0;
+                frames[l] = 0;
+                alone[l] = 0;
+                strikes[l] = 0;
+        }
+
+        inLockstep = lanes == 32 ? 0xFFFFFFFF : (1u << lanes) - 1;
+        dirty = 0;
+}
+
+Chip8Lockstep::~Chip8Lockstep()
+{
+        for(unsigned l = 0; l < MAX_LANES; ++l)
+        {
+                delete scalar[l];
+        }
+}
+
+void Chip8Lockstep::getLaneState(unsigned lane, Chip8State& state) const
+{ // Gathers one lane into the layout a scalar Chip8 uses
+        for(int a = 0; a < 4096; ++a)
+        {
+                state.memory[a] = memory[a][lane];
+        }
+        for(int r = 0; r < 16; ++r)
+        {
+                state.V[r] = V[r][lane];
+                state.stack[r] = stack[r][lane];
+                state.key[r] = (keys[lane] >> r) & 1;
+        }
+        state.I = I[lane];
+        state.pc = pc[lane];
+        state.sp = sp[lane];
+        memcpy(state.gfx[0], gfx[lane], sizeof(gfx[lane])); // Always plain CHIP-8, 64x32 in the first plane
+        state.delay_timer = delay_timer[lane];
+        state.sound_timer = sound_timer[lane];
+        state.rng = rng[lane];
+        state.waiting = 0; // A lane that reaches FX0A is peeled there, so none is ever waiting
+}
+
+void Chip8Lockstep::setLaneState(unsigned lane, const Chip8State& state)
+{ // Scatters a scalar machine's state into one lane
+        keys[lane] = 0;
+        for(int a = 0; a < 4096; ++a)
+        {
+                memory[a][lane] = state.memory[a];
+        }
+        for(int r = 0; r < 16; ++r)
+        {
+                V[r][lane] = state.V[r];
+                stack[r][lane] = state.stack[r];
+                keys[lane] |= (state.key[r] != 0) << r;
+        }
+        I[lane] = state.I;
+        pc[lane] = state.pc;
+        sp[lane] = state.sp;
+        memcpy(gfx[lane], state.gfx[0], sizeof(gfx[lane]));
+        memcpy(front[lane], state.gfx[0], sizeof(front[lane]));
+        delay_timer[lane] = state.delay_timer;
+        sound_timer[lane] = state.sound_timer;
+        rng[lane] = state.rng;
+}
+
+bool Chip8Lockstep::loadROM(const string& fileName)
+{
+        RomImage image;
+        return image.read(fileName) && loadROM(image);
+}
+
+bool Chip8Lockstep::loadROM(const RomImage& image)
+{ // Loads the ROM into every lane and puts them all back in lockstep
+        Chip8 loader;
+        if(!loader.loadROM(image))
+                return false;
+        Chip8State state;
+        loader.saveState(state);
+
+        for(unsigned l = 0; l < lanes; ++l)
+        {
+                delete scalar[l];
+                scalar[l] = NULL;
+                state.rng = rng[l]; // Seeds survive loading, as they do on a Chip8
+                setLaneState(l, state);
+                executed[l] = 0;
+                frames[l] = 0;
+                strikes[l] = 0;
+        }
+        inLockstep = lanes == 32 ? 0xFFFFFFFF : (1u << lanes) - 1;
+        dirty = 0;
+        credit = 0;
+        return true;
+}
+
+void Chip8Lockstep::setSeed(unsigned lane, unsigned seed)
+{ // Seeds CXNN for one lane, see Chip8::setSeed
+        if(scalar[lane])
+                scalar[lane]->setSeed(seed);
+        rng[lane] = seed ? seed : 0x9E3779B9;
+}
+
+void Chip8Lockstep::setInput(unsigned lane, Chip8Input* source)
+{ // Keyboard one lane reads its keys from, NULL for none
+        input[lane] = source;
+        if(scalar[lane])
+                scalar[lane]->setInput(source);
+}
+
+void Chip8Lockstep::peel(unsigned lane)
+{ // Moves a lane into a scalar Chip8 of its own, which also runs what the lane still owes this round
+        Chip8State state;
+        getLaneState(lane, state);
+
+        scalar[lane] = new Chip8;
+        scalar[lane]->loadState(state);
+        scalar[lane]->setInput(input[lane]);
+
+        inLockstep &= ~(1u << lane);
+        dirty &= ~(1u << lane);
+        executed[lane] -= remaining[lane];
+        executed[lane] += scalar[lane]->run(remaining[lane]);
+        remaining[lane] = 0;
+}
+
+void Chip8Lockstep::stepLane(unsigned lane, unsigned short op)
+{ // Runs op for a single lane, for the instructions that address memory, the stack or the screen per lane
+        unsigned x = (op >> 8) & 0xF;
+        unsigned y = (op >> 4) & 0xF;
+        unsigned char nn = op & 0xFF;
+        unsigned short& i = I[lane];
+        unsigned short& p = pc[lane];
+
+        switch(classify(op))
+        {
+        case OP_CLEAR:
+                memset(gfx[lane], 0, sizeof(gfx[lane]));
+                dirty |= 1u << lane;
+                p += 2;
+                break;
+        case OP_RETURN:
+                sp[lane] = (sp[lane] - 1) & 0xF;
+                p = stack[sp[lane]][lane] + 2;
+                break;
+        case OP_CALL:
+                stack[sp[lane]][lane] = p;
+                sp[lane] = (sp[lane] + 1) & 0xF;
+                p = op & 0xFFF;
+                break;
+        case OP_JUMP_V0:
+                p = ((op & 0xFFF) + V[0][lane]) & 0xFFF;
+                break;
+        case OP_RANDOM:
+                rng[lane] ^= rng[lane] << 13;
+                rng[lane] ^= rng[lane] >> 17;
+                rng[lane] ^= rng[lane] << 5;
+                V[x][lane] = (rng[lane] >> 24) & nn;
+                p += 2;
+                break;
+        case OP_DRAW:
+        {
+                unsigned column = V[x][lane] & 63;
+                unsigned row = V[y][lane] & 31;
+                V[0xF][lane] = 0;
+                for(unsigned line = 0; line < (op & 0xF); ++line)
+                {
+                        uint64_t pixels = (uint64_t) memory[(i + line) & 0xFFF][lane] << 56;
+                        if(column)
+                                pixels = (pixels >> column) | (pixels << (64 - column));
+
+                        uint64_t& bits = gfx[lane][(row + line) & 31];
+                        if(bits & pixels)
+                                V[0xF][lane] = 1;
+                        bits ^= pixels;
+                }
+                dirty |= 1u << lane;
+                p += 2;
+                break;
+        }
+        case OP_SKP:
+                p += ((keys[lane] >> (V[x][lane] & 0xF)) & 1) ? 4 : 2;
+                break;
+        case OP_SKNP:
+                p += ((keys[lane] >> (V[x][lane] & 0xF)) & 1) ? 2 : 4;
+                break;
+        case OP_ADD_I:
+                V[0xF][lane] = i + V[x][lane] > 0xFFF;
+                i += V[x][lane];
+                p += 2;
+                break;
+        case OP_SPRITE:
+                i = V[x][lane] * 5;
+                p += 2;
+                break;
+        case OP_BCD:
+        {
+                unsigned char value = V[x][lane];
+                memory[i & 0xFFF][lane] = value / 100;
+                memory[(i + 1) & 0xFFF][lane] = (value / 10) % 10;
+                memory[(i + 2) & 0xFFF][lane] = value % 10;
+                p += 2;
+                break;
+        }
+        case OP_STORE:
+                for(unsigned r = 0; r <= x; ++r)
+                {
+                        memory[(i + r) & 0xFFF][lane] = V[r][lane];
+                }
+                i += x + 1;
+                p += 2;
+                break;
+        case OP_LOAD:
+                for(unsigned r = 0; r <= x; ++r)
+                {
+                        V[r][lane] = memory[(i + r) & 0xFFF][lane];
+                }
+                i += x + 1;
+                p += 2;
+                break;
+        default: // Everything else has a vector kernel in runRound
+                break;
+        }
+}
+
+void Chip8Lockstep::runRound(unsigned budget)
+{ // Every lane runs `budget` more instructions; lanes in lockstep advance together wherever they share a pc
+        for(unsigned l = 0; l < lanes; ++l)
+        {
+                if(scalar[l] && scalar[l]->getChipState())
+                        executed[l] += scalar[l]->run(budget);
+                remaining[l] = (inLockstep >> l) & 1 ? budget : 0;
+                executed[l] += remaining[l];
+        }
+
+        int leader = -1;
+        for(;;)
+        {
+                if(leader < 0 || remaining[leader] == 0)
+                { // Follow whichever lane is furthest behind, the others catch up on it as it passes their pc
+                        leader = -1;
+                        for(unsigned l = 0; l < lanes; ++l)
+                        {
+                                if(remaining[l] && (leader < 0 || remaining[l] > remaining[leader]))
+                                        leader = l;
+                        }
+                        if(leader < 0)
+                                break;
+                }
+
+                unsigned short at = pc[leader];
+                if(at > 0xFFE)
+                { // Off the end of memory, where the machine stops as Chip8::emulateCycle does: leave that to a scalar Chip8
+                        Bytes off = andNot(wordsEqual(remaining, 0), wordsEqual(pc, at));
+                        for(uint32_t lane = laneBits(off); lane; lane &= lane - 1)
+                        {
+                                peel(__builtin_ctz(lane));
+                        }
+                        continue;
+                }
+                const unsigned char* high = memory[at & 0xFFF];
+                const unsigned char* low = memory[(at + 1) & 0xFFF];
+                unsigned short op = high[leader] << 8 | low[leader];
+
+                // Lanes at the same pc, with the same opcode there, that still have instructions to run
+                Bytes mask = bitAnd(andNot(wordsEqual(remaining, 0), wordsEqual(pc, at)),
+                                    bitAnd(equal(loadBytes(high), splat(op >> 8)), equal(loadBytes(low), splat(op & 0xFF))));
+                uint32_t bits = laneBits(mask);
+                if(__builtin_popcount(bits) < SMALL_GROUP)
+                        ++alone[leader];
+
+                unsigned char* vx = V[(op >> 8) & 0xF];
+                unsigned char* vy = V[(op >> 4) & 0xF];
+                unsigned char* vf = V[0xF];
+                Bytes nn = splat(op & 0xFF);
+                Bytes one = splat(1);
+                Bytes a, b;
+
+                LaneOp kind = classify(op);
+                switch(kind)
+                {
+                case OP_JUMP:
+                        setWords(pc, mask, op & 0xFFF);
+                        break;
+                case OP_SE:
+                case OP_SNE:
+                case OP_SE_XY:
+                case OP_SNE_XY:
+                {
+                        Bytes same = equal(loadBytes(vx), kind == OP_SE || kind == OP_SNE ? nn : loadBytes(vy));
+                        Bytes skip = kind == OP_SE || kind == OP_SE_XY ? bitAnd(mask, same) : andNot(same, mask);
+                        setWords(pc, mask, at + 2);
+                        setWords(pc, skip, at + 4);
+                        break;
+                }
+                case OP_SET:
+                        storeBytes(vx, blend(mask, nn, loadBytes(vx)));
+                        setWords(pc, mask, at + 2);
+                        break;
+                case OP_ADD:
+                        a = loadBytes(vx);
+                        storeBytes(vx, blend(mask, add(a, nn), a));
+                        setWords(pc, mask, at + 2);
+                        break;
+                case OP_MOV:
+                        storeBytes(vx, blend(mask, loadBytes(vy), loadBytes(vx)));
+                        setWords(pc, mask, at + 2);
+                        break;
+                case OP_OR:
+                        a = loadBytes(vx);
+                        storeBytes(vx, blend(mask, bitOr(a, loadBytes(vy)), a));
+                        storeBytes(vf, andNot(mask, loadBytes(vf)));
+                        setWords(pc, mask, at + 2);
+                        break;
+                case OP_AND:
+                        a = loadBytes(vx);
+                        storeBytes(vx, blend(mask, bitAnd(a, loadBytes(vy)), a));
+                        setWords(pc, mask, at + 2);
+                        break;
+                case OP_XOR:
+                        a = loadBytes(vx);
+                        storeBytes(vx, blend(mask, bitXor(a, loadBytes(vy)), a));
+                        setWords(pc, mask, at + 2);
+                        break;
+                // The flag is written before the result, and VX or VY may be VF, so both are loaded again after
+                case OP_ADD_XY:
+                        a = loadBytes(vx);
+                        b = add(a, loadBytes(vy));
+                        storeBytes(vf, blend(mask, andNot(equal(maxBytes(b, a), b), one), loadBytes(vf))); // Wrapped below VX: carry
+                        a = loadBytes(vx);
+                        storeBytes(vx, blend(mask, add(a, loadBytes(vy)), a));
+                        setWords(pc, mask, at + 2);
+                        break;
+                case OP_SUB_XY:
+                        a = loadBytes(vx);
+                        storeBytes(vf, blend(mask, bitAnd(equal(maxBytes(a, loadBytes(vy)), a), one), loadBytes(vf))); // VX >= VY: no borrow
+                        a = loadBytes(vx);
+                        storeBytes(vx, blend(mask, sub(a, loadBytes(vy)), a));
+                        setWords(pc, mask, at + 2);
+                        break;
+                case OP_SUBN_XY:
+                        b = loadBytes(vy);
+                        storeBytes(vf, blend(mask, bitAnd(equal(maxBytes(loadBytes(vx), b), b), one), loadBytes(vf))); // VY >= VX: no borrow
+                        a = loadBytes(vx);
+                        storeBytes(vx, blend(mask, sub(loadBytes(vy), a), a));
+                        setWords(pc, mask, at + 2);
+                        break;
+                case OP_SHR:
+                        storeBytes(vf, blend(mask, bitAnd(loadBytes(vx), one), loadBytes(vf)));
+                        a = loadBytes(vx);
+                        storeBytes(vx, blend(mask, shiftRight(a, 1), a));
+                        setWords(pc, mask, at + 2);
+                        break;
+                case OP_SHL:
+                        storeBytes(vf, blend(mask, shiftRight(loadBytes(vx), 7), loadBytes(vf)));
+                        a = loadBytes(vx);
+                        storeBytes(vx, blend(mask, add(a, a), a));
+                        setWords(pc, mask, at + 2);
+                        break;
+                case OP_SET_I:
+                        setWords(I, mask, op & 0xFFF);
+                        setWords(pc, mask, at + 2);
+                        break;
+                case OP_GET_DELAY:
+                        storeBytes(vx, blend(mask, loadBytes(delay_timer), loadBytes(vx)));
+                        setWords(pc, mask, at + 2);
+                        break;
+                case OP_SET_DELAY:
+                        storeBytes(delay_timer, blend(mask, loadBytes(vx), loadBytes(delay_timer)));
+                        setWords(pc, mask, at + 2);
+                        break;
+                case OP_SET_SOUND:
+                        storeBytes(sound_timer, blend(mask, loadBytes(vx), loadBytes(sound_timer)));
+                        setWords(pc, mask, at + 2);
+                        break;
+                case OP_WAIT_KEY:
+                case OP_UNKNOWN:
+                        // Blocking on input, or stopping the machine, is left to a scalar Chip8
+                        for(uint32_t lane = bits; lane; lane &= lane - 1)
+                        {
+                                peel(__builtin_ctz(lane));
+                        }
+                        continue;
+                default:
+                        for(uint32_t lane = bits; lane; lane &= lane - 1)
+                        {
+                                stepLane(__builtin_ctz(lane), op);
+                        }
+                        break;
+                }
+
+                decrementWords(remaining, mask);
+        }
+}
+
+unsigned long Chip8Lockstep::runFrame()
+{ // Runs one 60 Hz frame on every lane and ticks their timers, returns how many instructions ran in total
+        credit += cpuHz;
+        unsigned long budget = credit / Chip8Scheduler::TIMER_HZ;
+        credit %= Chip8Scheduler::TIMER_HZ;
+
+        uint32_t on = inLockstep;
+        unsigned long before = 0;
+        for(unsigned l = 0; l < lanes; ++l)
+        {
+                if(scalar[l] && scalar[l]->getChipState())
+                        on |= 1u << l;
+                before += executed[l];
+                alone[l] = 0;
+        }
+
+        for(unsigned long left = budget; left > 0; )
+        {
+                unsigned round = left < MAX_ROUND ? left : MAX_ROUND;
+                runRound(round);
+                left -= round;
+        }
+
+        // The 60 Hz tick, as Chip8::tickTimers does it, for every lane still in lockstep...
+        storeBytes(delay_timer, subSaturate(loadBytes(delay_timer), splat(1)));
+        storeBytes(sound_timer, subSaturate(loadBytes(sound_timer), splat(1)));
+
+        unsigned long after = 0;
+        for(unsigned l = 0; l < lanes; ++l)
+        {
+                if((on >> l) & 1)
+                        ++frames[l];
+
+                if((inLockstep >> l) & 1)
+                {
+                        if(input[l])
+                                keys[l] = input[l]->pollKeys();
+                        if((dirty >> l) & 1)
+                                memcpy(front[l], gfx[l], sizeof(gfx[l]));
+
+                        // ...and lanes that ran mostly on their own (or nearly) for a while go scalar
+                        strikes[l] = alone[l] * 2 > budget ? strikes[l] + 1 : 0;
+                        if(strikes[l] >= PEEL_AFTER)
+                        {
+                                remaining[l] = 0;
+                                peel(l);
+                        }
+                } else if((on >> l) & 1)
+                {
+                        scalar[l]->tickTimers();
+                }
+                after += executed[l];
+        }
+        dirty = 0;
+
+        return after - before;
+}
+
+unsigned long Chip8Lockstep::runFrames(unsigned long count)
+{ // Runs `count` frames, returns how many instructions ran in total
+        unsigned long total = 0;
+        unsigned long frame = 0;
+        for(; frame < count && inLockstep; ++frame)
+        {
+                total += runFrame();
+        }
+        if(frame == count)
+                return total;
+
+        // Every lane has been peeled: finish one machine at a time rather than a
+        // frame of each in turn, so only one of them needs to be in cache
+        vector<unsigned> budgets;
+        for(; frame < count; ++frame)
+        {
+                credit += cpuHz;
+                budgets.push_back(credit / Chip8Scheduler::TIMER_HZ);
+                credit %= Chip8Scheduler::TIMER_HZ;
+        }
+        for(unsigned l = 0; l < lanes; ++l)
+        {
+                for(unsigned f = 0; f < budgets.size() && scalar[l]->getChipState(); ++f)
+                {
+                        unsigned long ran = scalar[l]->run(budgets[f]);
+                        scalar[l]->tickTimers();
+                        executed[l] += ran;
+                        total += ran;
+                        ++frames[l];
+                }
+        }
+        return total;
+}
+
+unsigned Chip8Lockstep::getLanes() const
+{
+        return lanes;
+}
+
+bool Chip8Lockstep::getChipState(unsigned lane) const
+{ // Lanes in lockstep are always on, a lane that stops has been peeled first
+        return scalar[lane] ? scalar[lane]->getChipState() : true;
+}
+
+bool Chip8Lockstep::isPeeled(unsigned lane) const
+{
+        return scalar[lane] != NULL;
+}
+
+Chip8Frame Chip8Lockstep::getFrame(unsigned lane) const
+{ // The last frame published by a lane
+        if(scalar[lane])
+                return scalar[lane]->getFrame();
+        Chip8Frame frame = { front[lane], 64, 32, 1 };
+        return frame;
+}
+
+unsigned short Chip8Lockstep::getPC(unsigned lane) const
+{
+        return scalar[lane] ? scalar[lane]->getPC() : pc[lane];
+}
+
+bool Chip8Lockstep::getUnknownOpcode(unsigned lane, unsigned short& opcode) const
+{ // Lanes in lockstep never get to one, they're peeled first
+        return scalar[lane] ? scalar[lane]->getUnknownOpcode(opcode) : false;
+}
+
+void Chip8Lockstep::saveState(unsigned lane, Chip8State& state) const
+{ // A snapshot of one lane, as Chip8::saveState would take of a machine running alone
+        if(scalar[lane])
+                scalar[lane]->saveState(state);
+        else
+                getLaneState(lane, state);
+}
+
+unsigned long Chip8Lockstep::getInstructions(unsigned lane) const
+{ // Instructions the lane ran since its ROM was loaded
+        return executed[lane];
+}
+
+unsigned long Chip8Lockstep::getFrames(unsigned lane) const
+{ // Frames the lane ran since its ROM was loaded, not counting those after it stopped
+        return frames[lane];
+}
@@ -0,0 +1,88 @@
+#ifndef LOCKSTEP_H
+
+#define LOCKSTEP_H
+
+#include "Chip8.h"
+#include "Scheduler.h"
+
+// Runs up to 32 machines loaded with the same ROM side by side, laid out as
+// structure of arrays: V3 of every lane sits in one 32-byte row, as does each
+// byte of memory. An instruction is fetched once from a leader lane and run for
+// every lane sitting at the same pc (with the same opcode there) with a handful
+// of vector instructions, AVX2 when built with NATIVE=1 on a machine that has
+// it and SSE2 otherwise. Lanes somewhere else wait for the leader to come by.
+// Lanes that keep running on their own, or reach FX0A or a bad opcode, are
+// peeled off into a scalar Chip8 for good. Every lane runs exactly what a
+// Chip8 under a Chip8Scheduler would, instruction for instruction. Plain
+// CHIP-8 only: the extended modes run on scalar machines.
+class Chip8Lockstep
+{
+public:
+        static const unsigned MAX_LANES = 32;
+private:
+        // Rows of lanes, lane l of row r at [r][l]
+        unsigned char memory[4096][MAX_LANES];
+        unsigned char V[16][MAX_LANES];
+        unsigned short I[MAX_LANES];
+        unsigned short pc[MAX_LANES];
+        unsigned short stack[16][MAX_LANES];
+        unsigned char sp[MAX_LANES];
+        unsigned char delay_timer[MAX_LANES];
+        unsigned char sound_timer[MAX_LANES];
+        unsigned short remaining[MAX_LANES]; // Instructions each lane still owes the current round
+
+        // One machine after the other, so a frame can be handed out as it is
+        uint64_t gfx[MAX_LANES][32];
+        uint64_t front[MAX_LANES][32];
+
+        unsigned short keys[MAX_LANES];
+        unsigned rng[MAX_LANES];
+        Chip8Input* input[MAX_LANES];
+        Chip8* scalar[MAX_LANES]; // Peeled lanes, NULL while in lockstep
+
+        unsigned long executed[MAX_LANES];
+        unsigned long frames[MAX_LANES];
+        unsigned long alone[MAX_LANES]; // Instructions the lane led a group of fewer than SMALL_GROUP this frame
+        unsigned strikes[MAX_LANES];    // Frames in a row the lane spent mostly in small groups
+
+        unsigned lanes;
+        unsigned cpuHz;
+        unsigned credit;
+        uint32_t inLockstep; // Lanes not peeled off yet
+        uint32_t dirty;      // Lanes whose gfx changed since the last publish
+
+        static const unsigned MAX_ROUND = 0xFFFF; // remaining is 16 bits wide
+        static const unsigned SMALL_GROUP = 4; // Groups this small are cheaper run by scalar machines
+        static const unsigned PEEL_AFTER = 4;  // Frames in a row spent mostly in small groups before a lane is peeled
+
+        void getLaneState(unsigned lane, Chip8State& state) const;
+        void setLaneState(unsigned lane, const Chip8State& state);
+        void peel(unsigned lane);
+        void stepLane(unsigned lane, unsigned short op);
+        void runRound(unsigned budget);
+public:
+        Chip8Lockstep(unsigned laneCount, unsigned hz = Chip8Scheduler::DEFAULT_CPU_HZ);
+        ~Chip8Lockstep();
+        Chip8Lockstep(const Chip8Lockstep&) = delete;
+        Chip8Lockstep& operator=(const Chip8Lockstep&) = delete;
+
+        bool loadROM(const string& fileName);
+        bool loadROM(const RomImage& image);
+        void setSeed(unsigned lane, unsigned seed);
+        void setInput(unsigned lane, Chip8Input* source);
+
+        unsigned long runFrame();
+        unsigned long runFrames(unsigned long count);
+
+        unsigned getLanes() const;
+        bool getChipState(unsigned lane) const;
+        bool isPeeled(unsigned lane) const;
+        Chip8Frame getFrame(unsigned lane) const;
+        unsigned short getPC(unsigned lane) const;
+        bool getUnknownOpcode(unsigned lane, unsigned short& opcode) const;
+        void saveState(unsigned lane, Chip8State& state) const;
+        unsigned long getInstructions(unsigned lane) const;
+        unsigned long getFrames(unsigned lane) const;
+};
+
+#endif
@@ -1,87 +1,258 @@
 #include "Chip8.h"
+#include "Scheduler.h"
+#include "Rewind.h"
+#include "Movie.h"
+#include "Handoff.h"
+#include "SFMLFrontend.h"
 #include <SFML/Graphics.hpp>
-
-// The object by which we refer to the entire system
-Chip8 chip8;
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 // Screen dimension constants
 const int SCREEN_WIDTH = 10 * 64;
 const int SCREEN_HEIGHT = 10 * 32;
 const int SQUARE_SIDE = 10;
 
-// The window we will be rendering the output to
-sf::RenderWindow window;
-
 // Fixes, clears and then makes the window opaque
-void setupGraphics()
+void setupGraphics(sf::RenderWindow& window)
 { 
     window.create(sf::VideoMode(SCREEN_WIDTH, SCREEN_HEIGHT), "Shit-8");
     window.clear();
     window.display();
 }
 
-// Uses state of machine to render data
-void drawGraphics()
-{ 
-    window.clear();
-    std::vector<unsigned char> v = chip8.getGFXArray(); // Function which returns state of VRAM
-
-    // Iterating through the single dimension array as though it were two-dimensional
-    for (int y = 0; y < 32; ++y) {
-	for (int x = 0; x < 64; ++x) {
-	    if (v[y * 64 + x] == 1) {						  // Here we make use of our way of interpreting the array and simply interpret every 64th line as a newline
-		sf::RectangleShape shape(sf::Vector2f(SQUARE_SIDE, SQUARE_SIDE)); // Create the rectangle to be rendered
-		shape.setFillColor(sf::Color::White);				  // Set the fill color
-		shape.setPosition(x * SQUARE_SIDE, y * SQUARE_SIDE);		  // Assign the position
-		window.draw(shape);
-	    }
-	}
+// What the UI thread asks of the emulation thread, and what it hears back
+struct Controls
+{
+    atomic<bool> quit;      // Window closed
+    atomic<bool> save;      // F5 pressed, save the machine next to the ROM
+    atomic<bool> load;      // F9 pressed, restore it
+    atomic<bool> rewinding; // Backspace held
+    atomic<bool> idle;      // Emulation asleep until the next key or request
+    atomic<bool> finished;  // Emulation thread is done
+
+    Controls() : quit(false), save(false), load(false), rewinding(false), idle(false), finished(false) {}
+};
+
+// Window close and the save state keys, turned into requests for the emulation thread
+void handleEvent(const sf::Event& event, sf::RenderWindow& window, Controls& controls, SharedInput& input, bool recording)
+{
+    // "Close requested" event: we close the window and kill emulation
+    if (event.type == sf::Event::Closed)
+    {
+        window.close();
+        controls.quit = true;
     }
-    window.display(); // Now we display our result
+
+    // F5 saves the machine next to the ROM, F9 restores it
+    if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F5)
+        controls.save = true;
+    if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F9 && !recording)
+        controls.load = true;
+
+    input.signal(); // In case the emulation sleeps
 }
 
 int main(int argc, char** argv)
 {
-    setupGraphics(); // Ready up our window
-
-	string rom = argv[1];
-    chip8.loadROM(rom); // Load the ROM from the given path
-
-	// SFML specific, when window is closed condition is returned (after the event is handled) false
-    while (window.isOpen()) 
-	{ 
-		sf::Clock clock; // SFML clock object to use as a timer
-		sf::Time currTime = clock.getElapsedTime();
-		sf::Event event; // SFML event object to listen for a clsoing event
-
-		while (chip8.getChipState()) 
-		{
-			currTime = clock.getElapsedTime();
-
-			if (currTime.asSeconds() >= 0.002) // Make sure an adequate amount of time has passed since last cycle
-			{
-					currTime = clock.restart(); // Reset the timer
-					chip8.printDebug();
-					chip8.emulateCycle();       // Go through with a single emulation cycle
-					cout << "Emulated" << endl;
-
-					if (chip8.getDrawFlag()) 
-					{    // If set a change has been made in VRAM and needs an update in visual representation
-						drawGraphics();	   // Get VRAM and draw visual representation
-						chip8.setDrawFlag(false); // With the update we need not draw anymore as of right now
-					}
-			}
-
-			// Check all the window's events that were triggered since the last iteration of the loop
-			while (window.pollEvent(event)) 
-			{
-					// "Close requested" event: we close the window and kill emulation
-					if (event.type == sf::Event::Closed) 
-					{
-						window.close();
-						chip8.shutdown(); // Sets flag of machine to return false when calling getChipState()
-					}
-			}
-		}
+    string rom;
+    unsigned hz = Chip8Scheduler::DEFAULT_CPU_HZ;
+    bool turbo = false;
+    bool vsync = false;
+    Chip8::Mode mode = Chip8::CHIP8;
+    const char* traceFile = NULL;
+    bool traceBinary = false;
+    const char* profileFile = NULL;
+    const char* recordFile = NULL;
+    const char* replayFile = NULL;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--hz") == 0 && i + 1 < argc)
+            hz = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--turbo") == 0)
+            turbo = true;
+        else if (strcmp(argv[i], "--vsync") == 0)
+            vsync = true;
+        else if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc && Chip8::modeFromName(argv[i + 1], mode))
+            ++i;
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            traceFile = argv[++i];
+        else if (strcmp(argv[i], "--trace-binary") == 0)
+            traceBinary = true;
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+            profileFile = argv[++i];
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            recordFile = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            replayFile = argv[++i];
+        else
+            rom = argv[i];
+    }
+
+    if (rom.empty() || hz == 0)
+    {
+        cerr << "Usage: " << argv[0] << " [--hz N] [--turbo] [--vsync] [--mode chip8|schip|xochip] [--trace FILE [--trace-binary]] [--profile FILE] [--record FILE | --replay FILE] <rom>" << endl;
+        return 1;
+    }
+
+    // The object by which we refer to the entire system, and the window we will be rendering the output to
+    Chip8 chip8;
+    sf::RenderWindow window;
+
+    setupGraphics(window); // Ready up our window
+    window.setVerticalSyncEnabled(vsync); // Presenting a changed frame then also waits for the display
+
+    // Plug the SFML keyboard, speaker and window into the machine. The core runs on
+    // its own thread: keys reach it through an atomic and frames come back through a
+    // triple buffer, so neither a slow present nor a busy frame holds up the other.
+    SFMLInput keyboard;
+    SharedInput input;
+    SFMLAudio audio; // Fed lock-free already
+    SFMLVideo video(window, SQUARE_SIDE);
+    TripleBuffer frames;
+    chip8.setInput(&input);
+    chip8.setAudio(&audio);
+
+    // Keys are recorded once per tick along with the seed, or played back from a
+    // recording (after which the keyboard takes over)
+    Chip8Movie movie;
+    movie.romHash = Chip8Movie::hashROM(rom);
+    movie.seed = time(NULL);
+    movie.cpuHz = hz;
+    movie.engine = 0; // The window always runs the interpreter
+    movie.mode = mode;
+    if (replayFile)
+    {
+        if (!movie.load(replayFile))
+            return 1;
+        if (movie.romHash != Chip8Movie::hashROM(rom))
+            cerr << replayFile << " was recorded on a different ROM" << endl;
+        hz = movie.cpuHz;
+        mode = (Chip8::Mode) movie.mode;
     }
+    MovieRecorder recorder(movie, &input);
+    MoviePlayer player(movie, &input);
+    chip8.setMode(mode);
+    chip8.setSeed(movie.seed);
+    if (recordFile)
+        chip8.setInput(&recorder);
+    else if (replayFile)
+        chip8.setInput(&player);
+    chip8.setVideo(&frames);
+
+    if (!chip8.loadROM(rom)) // Load the ROM from the given path
+        return 1;
+
+    // Optionally record every instruction, drained to a file by a background thread
+    Chip8Trace trace(20); // Room for about a million instructions between drains
+    ofstream traceOut;
+    Chip8TraceWriter* traceWriter = NULL;
+    if (traceFile)
+    {
+#ifndef CHIP8_TRACE
+        cerr << "Tracing isn't compiled in, rebuild with 'make TRACE=1'" << endl;
+#endif
+        traceOut.open(traceFile, traceBinary ? ios::out | ios::binary : ios::out);
+        chip8.setTrace(&trace);
+        traceWriter = new Chip8TraceWriter(trace, traceOut, traceBinary);
+    }
+
+    // Optionally count executions and time per handler and per address, written at exit
+    Chip8Profile profile;
+    if (profileFile)
+    {
+#ifndef CHIP8_PROFILE
+        cerr << "Profiling isn't compiled in, rebuild with 'make PROFILE=1'" << endl;
+#endif
+        chip8.setProfile(&profile);
+    }
+
+    // Runs hz / 60 instructions per frame and ticks the timers at 60 Hz, sleeping in between
+    Chip8Scheduler scheduler(chip8, hz);
+    scheduler.setTurbo(turbo);
+
+    Controls controls;
+
+    thread emulation([&]
+    {
+        // The last ten seconds, one state per frame, played back while Backspace is held
+        Chip8Rewind rewind(60 * 10);
+        Chip8State state;
+        vector<unsigned char> upper; // XO-CHIP's memory past 4 KB, empty in the other modes
+
+        while (!controls.quit && chip8.getChipState())
+        {
+            unsigned seen = input.getEvents(); // Anything signalled from here on keeps us from sleeping below
+
+            if (controls.save.exchange(false))
+                chip8.saveState(rom + ".state");
+            if (controls.load.exchange(false))
+                chip8.loadState(rom + ".state");
+
+            if (controls.rewinding)
+            {
+                if (rewind.stepBack(state, upper))
+                    chip8.loadState(state, upper); // Also republishes the restored screen
+            }
+            else
+            {
+                scheduler.runFrame();       // A frame's worth of instructions, then timers, keyboard, sound and a new frame if VRAM changed
+                chip8.saveState(state, upper);
+                rewind.push(state, upper);
+            }
+
+            // Stuck on FX0A or polling the keys with the timers stopped, only a key can change anything:
+            // sleep until the UI thread signals instead of ticking empty frames
+            if (chip8.isIdle() && !controls.rewinding && (!replayFile || player.finished()))
+            {
+                controls.idle = true;
+                input.waitForEvent(seen);
+                controls.idle = false;
+                scheduler.resync(); // The time spent asleep is not owed to the emulation
+            }
+
+            scheduler.waitForNextFrame();   // Sleep until the next frame is due (no-op in turbo mode)
+        }
+        controls.finished = true;
+    });
+
+    sf::Event event; // SFML event object to listen for a clsoing event
+
+    // The UI thread: window events, keyboard and presenting whatever frame is newest
+    while (window.isOpen() && !controls.finished)
+    {
+        while (window.pollEvent(event))
+            handleEvent(event, window, controls, input, recordFile != NULL);
+
+        input.setKeys(keyboard.pollKeys());
+        bool back = !recordFile && sf::Keyboard::isKeyPressed(sf::Keyboard::BackSpace); // Would leave the recording behind
+        if (controls.rewinding.exchange(back) != back)
+            input.signal();
+
+        bool idle = controls.idle; // Before looking for a frame, so the last one before sleeping isn't missed
+        Chip8Frame frame;
+        if (frames.latest(frame))
+            video.drawFrame(frame);  // Waits for the display with --vsync, the emulation doesn't
+        else if (idle && window.waitEvent(event))
+            handleEvent(event, window, controls, input, recordFile != NULL); // Nothing will change before the user does something
+        else
+            this_thread::sleep_for(chrono::milliseconds(1));
+    }
+
+    controls.quit = true;
+    input.signal();
+    emulation.join();
+
+    unsigned short opcode;
+    if (chip8.getUnknownOpcode(opcode))
+        cerr << "Unknown opcode " << hex << opcode << " at " << chip8.getPC() << endl;
+
+    delete traceWriter; // Flushes what's left in the buffer
+    if (recordFile)
+        movie.save(recordFile);
+    if (profileFile)
+        profile.write(profileFile);
 }
@@ -0,0 +1,142 @@
+#include "Movie.h"
+#include <iostream>
+#include <fstream>
+#include <string.h>
+
+// Movie file layout, all multi-byte values little-endian:
+//   "C8MV", version (4), ROM hash (8), seed (4), CPU Hz (4), engine (1), mode (1), ticks (4),
+//   then runs of identical ticks as key mask (2) and length (2) until all ticks are covered
+static const char MOVIE_MAGIC[4] = { 'C', '8', 'M', 'V' };
+
+static void writeLE(ostream& out, uint64_t value, int bytes)
+{
+        for(int i = 0; i < bytes; ++i)
+        {
+                out.put((char) (value >> (8 * i)));
+        }
+}
+
+static uint64_t readLE(istream& in, int bytes)
+{
+        uint64_t value = 0;
+        for(int i = 0; i < bytes; ++i)
+        {
+                value |= uint64_t((unsigned char) in.get()) << (8 * i);
+        }
+        return value;
+}
+
+bool Chip8Movie::save(const string& fileName) const
+{ // Writes the movie to fileName, returns false if the file couldn't be written
+        ofstream file(fileName, ios::binary);
+        file.write(MOVIE_MAGIC, 4);
+        writeLE(file, VERSION, 4);
+        writeLE(file, romHash, 8);
+        writeLE(file, seed, 4);
+        writeLE(file, cpuHz, 4);
+        writeLE(file, engine, 1);
+        writeLE(file, mode, 1);
+        writeLE(file, keys.size(), 4);
+
+        // Keys mostly stay the same for many ticks in a row
+        for(size_t i = 0; i < keys.size(); )
+        {
+                size_t run = 1;
+                while(i + run < keys.size() && keys[i + run] == keys[i] && run < 0xFFFF)
+                {
+                        ++run;
+                }
+                writeLE(file, keys[i], 2);
+                writeLE(file, run, 2);
+                i += run;
+        }
+
+        if(!file)
+        {
+                cerr << "Could not write movie " << fileName << endl;
+                return false;
+        }
+        return true;
+}
+
+bool Chip8Movie::load(const string& fileName)
+{ // Reads a movie from fileName, leaves this one untouched and returns false if the file isn't a valid movie
+        ifstream file(fileName, ios::binary);
+        char magic[4] = { 0 };
+        file.read(magic, 4);
+        if(!file || memcmp(magic, MOVIE_MAGIC, 4) != 0)
+        {
+                cerr << "Not a movie: " << fileName << endl;
+                return false;
+        }
+
+        unsigned version = readLE(file, 4);
+        if(version != VERSION)
+        {
+                cerr << "Unsupported movie version " << version << " in " << fileName << endl;
+                return false;
+        }
+
+        Chip8Movie movie;
+        movie.romHash = readLE(file, 8);
+        movie.seed = readLE(file, 4);
+        movie.cpuHz = readLE(file, 4);
+        movie.engine = readLE(file, 1);
+        movie.mode = readLE(file, 1);
+        size_t ticks = readLE(file, 4);
+        while(movie.keys.size() < ticks && file)
+        {
+                unsigned short mask = readLE(file, 2);
+                size_t run = readLE(file, 2);
+                movie.keys.insert(movie.keys.end(), run, mask);
+        }
+
+        if(!file || movie.keys.size() != ticks)
+        {
+                cerr << "Movie " << fileName << " is cut short" << endl;
+                return false;
+        }
+        *this = movie;
+        return true;
+}
+
+uint64_t Chip8Movie::hashROM(const string& fileName)
+{ // FNV-1a over the ROM file, so a movie isn't played back on the wrong game
+        ifstream file(fileName, ios::binary);
+        uint64_t hash = 14695981039346656037ULL;
+        for(int c = file.get(); c != EOF; c = file.get())
+        {
+                hash ^= (unsigned char) c;
+                hash *= 1099511628211ULL;
+        }
+        return hash;
+}
+
+MovieRecorder::MovieRecorder(Chip8Movie& target, Chip8Input* from)
+        : source(from), movie(target)
+{
+}
+
+unsigned short MovieRecorder::pollKeys()
+{
+        unsigned short keys = source ? source->pollKeys() : 0;
+        movie.keys.push_back(keys);
+        return keys;
+}
+
+MoviePlayer::MoviePlayer(const Chip8Movie& recorded, Chip8Input* then)
+        : movie(recorded), after(then), next(0)
+{
+}
+
+unsigned short MoviePlayer::pollKeys()
+{
+        if(next < movie.keys.size())
+                return movie.keys[next++];
+        return after ? after->pollKeys() : 0;
+}
+
+bool MoviePlayer::finished() const
+{ // True once every recorded tick has been handed out
+        return next >= movie.keys.size();
+}
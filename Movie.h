@@ -0,0 +1,59 @@
+#ifndef MOVIE_H
+
+#define MOVIE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "Frontend.h"
+
+using namespace std;
+
+// A recorded session: the keys held at every 60 Hz tick, plus everything else
+// that decides how a run goes (the ROM, the seed for CXNN, the CPU speed, the
+// engine and the instruction set). Playing one back on a machine set up the same way reproduces the
+// session frame for frame, at whatever speed the host allows.
+struct Chip8Movie
+{
+        uint64_t romHash;
+        unsigned seed;
+        unsigned cpuHz;
+        unsigned char engine;
+        unsigned char mode;          // Chip8::Mode
+        vector<unsigned short> keys; // One key mask per tick
+
+        static const unsigned VERSION = 2;
+
+        bool save(const string& fileName) const;
+        bool load(const string& fileName);
+
+        static uint64_t hashROM(const string& fileName);
+};
+
+// Passes the keys of another input through and appends them to a movie
+class MovieRecorder : public Chip8Input
+{
+private:
+        Chip8Input* source;
+        Chip8Movie& movie;
+public:
+        MovieRecorder(Chip8Movie& target, Chip8Input* from = NULL);
+        unsigned short pollKeys();
+};
+
+// Hands out the keys of a movie one tick at a time, then those of another
+// input (or none) once the movie is over
+class MoviePlayer : public Chip8Input
+{
+private:
+        const Chip8Movie& movie;
+        Chip8Input* after;
+        size_t next;
+public:
+        MoviePlayer(const Chip8Movie& recorded, Chip8Input* then = NULL);
+        unsigned short pollKeys();
+        bool finished() const;
+};
+
+#endif
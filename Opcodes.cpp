@@ -0,0 +1,106 @@
+#include "Chip8.h"
+
+// Chip8::decode's table, one byte per opcode and mode, generated by the compiler:
+// kindOf() below is the whole instruction set, and every entry of opcodeKinds
+// is kindOf() of its index, so the three tables end up as constant data with
+// nothing left to work out at startup, let alone per instruction.
+
+constexpr unsigned char Chip8::systemKind(Mode machine, unsigned op)
+{ // 0x00E0, 0x00EE, and the screen instructions of the extended modes
+        return op == 0x00E0 ? KIND_CLEAR
+             : op == 0x00EE ? KIND_RETURN
+             : machine != CHIP8 && (op & 0xFFF0) == 0x00C0 ? KIND_SCROLL_DOWN
+             : machine == XOCHIP && (op & 0xFFF0) == 0x00D0 ? KIND_SCROLL_UP
+             : machine == CHIP8 ? KIND_UNKNOWN
+             : op == 0x00FB ? KIND_SCROLL_RIGHT
+             : op == 0x00FC ? KIND_SCROLL_LEFT
+             : op == 0x00FD ? KIND_EXIT
+             : op == 0x00FE ? KIND_LORES
+             : op == 0x00FF ? KIND_HIRES
+             : KIND_UNKNOWN;
+}
+
+constexpr unsigned char Chip8::arithmeticKind(unsigned op)
+{ // 0x8XY0 to 0x8XYE
+        return (op & 0xF) == 0x0 ? KIND_VX_VY
+             : (op & 0xF) == 0x1 ? KIND_VX_OR_VY
+             : (op & 0xF) == 0x2 ? KIND_VX_AND_VY
+             : (op & 0xF) == 0x3 ? KIND_VX_XOR_VY
+             : (op & 0xF) == 0x4 ? KIND_ADD_VY_VX
+             : (op & 0xF) == 0x5 ? KIND_SUB_VY_VX
+             : (op & 0xF) == 0x6 ? KIND_SHIFT_VX_RIGHT
+             : (op & 0xF) == 0x7 ? KIND_SET_VX_VY_SUB_VX
+             : (op & 0xF) == 0xE ? KIND_SHIFT_VX_LEFT
+             : KIND_UNKNOWN;
+}
+
+constexpr unsigned char Chip8::miscKind(Mode machine, unsigned op)
+{ // 0xFXNN: timers, keys, I and memory, plus what the extended modes add
+        return (op & 0xFF) == 0x07 ? KIND_VX_DELAY
+             : (op & 0xFF) == 0x0A ? KIND_WAIT_KEY
+             : (op & 0xFF) == 0x15 ? KIND_SET_DELAY
+             : (op & 0xFF) == 0x18 ? KIND_SET_SOUND
+             : (op & 0xFF) == 0x1E ? KIND_ADD_VX_TO_I
+             : (op & 0xFF) == 0x29 ? KIND_SET_I_SPRITE
+             : (op & 0xFF) == 0x33 ? KIND_STORE_BCD
+             : (op & 0xFF) == 0x55 ? KIND_STORE_V0_VX
+             : (op & 0xFF) == 0x65 ? KIND_LOAD_V0_VX
+             : machine == CHIP8 ? KIND_UNKNOWN
+             : (op & 0xFF) == 0x30 ? KIND_SET_I_BIG_SPRITE
+             : (op & 0xFF) == 0x75 ? KIND_STORE_FLAGS
+             : (op & 0xFF) == 0x85 ? KIND_LOAD_FLAGS
+             : machine != XOCHIP ? KIND_UNKNOWN
+             : op == 0xF000 ? KIND_SET_I_LONG
+             : (op & 0xFF) == 0x01 ? KIND_SELECT_PLANES
+             : op == 0xF002 ? KIND_LOAD_PATTERN
+             : (op & 0xFF) == 0x3A ? KIND_SET_PITCH
+             : KIND_UNKNOWN;
+}
+
+constexpr unsigned char Chip8::kindOf(Mode machine, unsigned op)
+{ // C++11 only allows a constexpr function one expression, hence the ternaries
+        return op >> 12 == 0x0 ? systemKind(machine, op)
+             : op >> 12 == 0x1 ? KIND_JUMP
+             : op >> 12 == 0x2 ? KIND_SUB
+             : op >> 12 == 0x3 ? KIND_SKIP_IF_VX
+             : op >> 12 == 0x4 ? KIND_SKIP_IF_NOT_VX
+             : op >> 12 == 0x5 ? (machine != XOCHIP || (op & 0xF) == 0x0 ? KIND_SKIP_IF_VX_VY // XO-CHIP adds 0x5XY2 and 0x5XY3
+                                  : (op & 0xF) == 0x2 ? KIND_SAVE_VX_VY
+                                  : (op & 0xF) == 0x3 ? KIND_LOAD_VX_VY
+                                  : KIND_UNKNOWN)
+             : op >> 12 == 0x6 ? KIND_SET_VX
+             : op >> 12 == 0x7 ? KIND_ADD_TO_VX
+             : op >> 12 == 0x8 ? arithmeticKind(op)
+             : op >> 12 == 0x9 ? KIND_SKIP_IF_VX_NOT_VY
+             : op >> 12 == 0xA ? KIND_SET_I
+             : op >> 12 == 0xB ? KIND_JUMP_ADD_V0
+             : op >> 12 == 0xC ? KIND_SET_VX_RANDOM
+             : op >> 12 == 0xD ? (machine == CHIP8 ? KIND_DRAW : KIND_DRAW_PLANES) // Planes, 16x16 sprites and 128x64 outside of plain CHIP-8
+             : op >> 12 == 0xE ? ((op & 0xFF) == 0x9E ? KIND_SKIP_IF_KEY_VX : (op & 0xFF) == 0xA1 ? KIND_SKIP_IF_KEY_NOT_VX : KIND_UNKNOWN)
+             : miscKind(machine, op);
+}
+
+// 0, 1, ..., N - 1 as a parameter pack, built by halves so the nesting stays at log2(N)
+template<unsigned... Ops> struct Opcodes { typedef Opcodes type; };
+
+template<class Low, class High> struct Join;
+template<unsigned... Low, unsigned... High> struct Join<Opcodes<Low...>, Opcodes<High...> >
+        : Opcodes<Low..., (sizeof...(Low) + High)...> {};
+
+template<unsigned N> struct Count : Join<typename Count<N / 2>::type, typename Count<N - N / 2>::type> {};
+template<> struct Count<0> : Opcodes<> {};
+template<> struct Count<1> : Opcodes<0> {};
+
+template<unsigned... Ops>
+static constexpr array<unsigned char, sizeof...(Ops)> kinds(unsigned char (*kindOf) (Chip8::Mode, unsigned),
+                                                            Chip8::Mode machine, Opcodes<Ops...>)
+{ // kindOf is private, the table's initializer passes it in
+        return {{ kindOf(machine, Ops)... }};
+}
+
+const array<unsigned char, 0x10000> Chip8::opcodeKinds[3] =
+        {
+                kinds(&kindOf, CHIP8, Count<0x10000>()),
+                kinds(&kindOf, SCHIP, Count<0x10000>()),
+                kinds(&kindOf, XOCHIP, Count<0x10000>())
+        };
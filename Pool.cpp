@@ -0,0 +1,58 @@
+#include "Pool.h"
+
+Chip8Pool::Chip8Pool()
+{
+        built = 0;
+}
+
+Chip8Pool::~Chip8Pool()
+{ // Machines still taken are their owners' to give back before this
+        for(unsigned i = 0; i < idle.size(); ++i)
+        {
+                delete idle[i];
+        }
+}
+
+Chip8* Chip8Pool::take(const RomImage& rom, Chip8::Mode mode)
+{ // A machine in mode that has just loaded rom, with no frontend, trace, profile or compiled program attached and its engine as it was left. NULL if rom doesn't fit
+        Chip8* chip = NULL;
+        {
+                lock_guard<mutex> guard(lock);
+                if(!idle.empty())
+                {
+                        chip = idle.back();
+                        idle.pop_back();
+                } else
+                {
+                        ++built;
+                }
+        }
+
+        if(!chip)
+                chip = new Chip8;
+        if(!chip->reset(rom, mode))
+        {
+                giveBack(chip);
+                return NULL;
+        }
+        return chip;
+}
+
+void Chip8Pool::giveBack(Chip8* chip)
+{
+        chip->setInput(NULL);
+        chip->setAudio(NULL);
+        chip->setVideo(NULL);
+        chip->setTrace(NULL);
+        chip->setProfile(NULL);
+        chip->setProgram(NULL);
+
+        lock_guard<mutex> guard(lock);
+        idle.push_back(chip);
+}
+
+unsigned Chip8Pool::getBuilt()
+{
+        lock_guard<mutex> guard(lock);
+        return built;
+}
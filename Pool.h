@@ -0,0 +1,33 @@
+#ifndef POOL_H
+
+#define POOL_H
+
+#include <mutex>
+
+#include "Chip8.h"
+
+// Machines for runs of many short-lived instances. Instead of being built and
+// loaded from scratch, a machine taken from the pool is reset from the ROM
+// image it boots (already in memory, so nothing bigger than the ROM is kept
+// per ROM) and keeps the instructions it decoded (and the blocks it
+// translated) wherever the image's memory is the same, so one instance after
+// another of a ROM starts warm. Only as many machines are ever built as are
+// in use at once. Thread-safe.
+class Chip8Pool
+{
+private:
+        mutex lock;
+        vector<Chip8*> idle;  // Given back, most recently first out
+        unsigned built;
+public:
+        Chip8Pool();
+        ~Chip8Pool();
+        Chip8Pool(const Chip8Pool&) = delete;
+        Chip8Pool& operator=(const Chip8Pool&) = delete;
+
+        Chip8* take(const RomImage& rom, Chip8::Mode mode);
+        void giveBack(Chip8* chip);
+        unsigned getBuilt();
+};
+
+#endif
@@ -0,0 +1,122 @@
+#include "Profile.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <math.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+Chip8Profile::Chip8Profile()
+{
+        for(unsigned k = 0; k < MAX_KINDS; ++k)
+        {
+                kinds[k].name = "?";
+        }
+        clear();
+}
+
+void Chip8Profile::clear()
+{
+        for(unsigned k = 0; k < MAX_KINDS; ++k)
+        {
+                kinds[k].count = 0;
+                kinds[k].cycles = 0;
+        }
+        memset(addresses, 0, sizeof(addresses));
+}
+
+void Chip8Profile::nameKind(unsigned kind, const char* name)
+{
+        if(kind < MAX_KINDS)
+                kinds[kind].name = name;
+}
+
+uint64_t Chip8Profile::now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void Chip8Profile::writeReport(ostream& out, unsigned hottest) const
+{ // Handlers by total time, then the most executed addresses
+        unsigned long long count = 0, cycles = 0;
+        vector<unsigned> order;
+        for(unsigned k = 0; k < MAX_KINDS; ++k)
+        {
+                count += kinds[k].count;
+                cycles += kinds[k].cycles;
+                if(kinds[k].count)
+                        order.push_back(k);
+        }
+        sort(order.begin(), order.end(), [this](unsigned a, unsigned b) { return kinds[a].cycles > kinds[b].cycles; });
+
+        out << fixed << setprecision(1);
+        out << left << setw(18) << "handler" << right << setw(14) << "executions" << setw(8) << "%"
+            << setw(16) << "cycles" << setw(8) << "%" << setw(10) << "per op" << '\n';
+        for(unsigned i = 0; i < order.size(); ++i)
+        {
+                const Kind& k = kinds[order[i]];
+                out << left << setw(18) << k.name << right << setw(14) << k.count << setw(8) << 100.0 * k.count / count
+                    << setw(16) << k.cycles << setw(8) << (cycles ? 100.0 * k.cycles / cycles : 0.0)
+                    << setw(10) << (double) k.cycles / k.count << '\n';
+        }
+        out << left << setw(18) << "total" << right << setw(14) << count << setw(8) << "" << setw(16) << cycles << '\n';
+
+        vector<unsigned> hot;
+        for(unsigned a = 0; a < 4096; ++a)
+        {
+                if(addresses[a])
+                        hot.push_back(a);
+        }
+        sort(hot.begin(), hot.end(), [this](unsigned a, unsigned b) { return addresses[a] > addresses[b]; });
+        if(hot.size() > hottest)
+                hot.resize(hottest);
+
+        out << '\n' << left << setw(18) << "address" << right << setw(14) << "executions" << setw(8) << "%" << '\n';
+        for(unsigned i = 0; i < hot.size(); ++i)
+        {
+                out << "0x" << hex << setfill('0') << setw(3) << hot[i] << dec << setfill(' ') << setw(13) << ""
+                    << setw(14) << addresses[hot[i]] << setw(8) << 100.0 * addresses[hot[i]] / count << '\n';
+        }
+        out << defaultfloat << left;
+}
+
+void Chip8Profile::writeHeatmap(ostream& out) const
+{ // Plain PGM, 64 addresses per row, brightness on a log scale so that cold code still shows
+        unsigned long long most = 1;
+        for(unsigned a = 0; a < 4096; ++a)
+        {
+                most = max(most, addresses[a]);
+        }
+
+        out << "P2\n64 64\n255\n";
+        for(unsigned y = 0; y < 64; ++y)
+        {
+                for(unsigned x = 0; x < 64; ++x)
+                {
+                        unsigned long long n = addresses[y * 64 + x];
+                        out << (n ? 32 + (int) (223 * log((double) n) / log((double) most + 1)) : 0) << (x < 63 ? ' ' : '\n');
+                }
+        }
+}
+
+bool Chip8Profile::write(const string& fileName) const
+{ // The report to fileName and the heatmap next to it, as fileName.pgm
+        ofstream report(fileName);
+        writeReport(report);
+        ofstream heatmap(fileName + ".pgm");
+        writeHeatmap(heatmap);
+        if(!report || !heatmap)
+        {
+                cerr << "Could not write profile " << fileName << endl;
+                return false;
+        }
+        return true;
+}
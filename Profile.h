@@ -0,0 +1,79 @@
+#ifndef PROFILE_H
+
+#define PROFILE_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+// Counts what a machine spends its time on: executions and host cycles per
+// instruction handler (fused and cache-miss handlers included), and executions
+// per address. Written out as a report sorted by time and as a 64x64 heatmap
+// of the 4 KB address space, one pixel per byte.
+class Chip8Profile
+{
+public:
+        static const unsigned MAX_KINDS = 64;
+private:
+        struct Kind
+        {
+                const char* name;
+                unsigned long long count;
+                unsigned long long cycles;
+        };
+
+        Kind kinds[MAX_KINDS];
+        unsigned long long addresses[4096];
+public:
+        Chip8Profile();
+
+        void clear();
+        void nameKind(unsigned kind, const char* name);
+
+        void record(unsigned kind, unsigned short pc, uint64_t cycles)
+        {
+                Kind& k = kinds[kind];
+                ++k.count;
+                k.cycles += cycles;
+                ++addresses[pc & 0xFFF];
+        }
+
+        // For translated blocks, whose body instructions don't keep pc up to date
+        void recordKind(unsigned kind, uint64_t cycles)
+        {
+                ++kinds[kind].count;
+                kinds[kind].cycles += cycles;
+        }
+        void recordRange(unsigned short start, unsigned short last)
+        { // One execution of every instruction from start to last
+                for(unsigned a = start; a <= last && a < 4096; a += 2)
+                {
+                        ++addresses[a];
+                }
+        }
+
+        static uint64_t now(); // Host cycle counter (nanoseconds where there is none)
+
+        void writeReport(ostream& out, unsigned hottest = 20) const;
+        void writeHeatmap(ostream& out) const;
+        bool write(const string& fileName) const;
+};
+
+// Profiling is compiled in only with -DCHIP8_PROFILE (make PROFILE=1); otherwise
+// both hooks expand to nothing. START opens a measurement of the instruction at
+// pc in the current scope, STOP closes it.
+#ifdef CHIP8_PROFILE
+#define CHIP8_PROFILE_START(profile, pc) \
+        uint64_t profileStart = (profile) ? Chip8Profile::now() : 0; \
+        unsigned short profilePC = (pc)
+#define CHIP8_PROFILE_STOP(profile, kind) \
+        do { if(profile) (profile)->record((kind), profilePC, Chip8Profile::now() - profileStart); } while(0)
+#else
+#define CHIP8_PROFILE_START(profile, pc) do { } while(0)
+#define CHIP8_PROFILE_STOP(profile, kind) do { } while(0)
+#endif
+
+#endif
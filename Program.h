@@ -0,0 +1,30 @@
+#ifndef PROGRAM_H
+
+#define PROGRAM_H
+
+#include "Chip8.h"
+
+// A ROM recompiled ahead of time to C++ by chip-8-aot: one native function per
+// basic block reachable from 0x200. Each function runs its block on the
+// machine's state and leaves pc at whatever comes next. Instructions that draw,
+// wait for a key, write memory or aren't known are left out of the blocks and
+// run by the interpreter. So are computed jumps (BNNN) that land outside a
+// compiled block, and blocks whose memory has been written since loading.
+// Plain CHIP-8 only.
+struct Chip8Compiled
+{
+        unsigned short start;            // Address of the first instruction
+        unsigned short end;              // One past the last byte compiled
+        unsigned count;                  // Number of CHIP-8 instructions it stands for
+        void (*run) (Chip8State& state);
+};
+
+struct Chip8Program
+{
+        uint64_t romHash;                // FNV-1a of the ROM it was compiled from, as RomImage::hash
+        unsigned romSize;
+        unsigned count;
+        const Chip8Compiled* blocks;
+};
+
+#endif
@@ -0,0 +1,184 @@
+#include "Rewind.h"
+
+// A delta is a list of runs: bytes to skip (2 bytes, little-endian), run length
+// (1 byte), then that many bytes to XOR in. Applying a delta twice undoes it.
+static void encodeDelta(const unsigned char* a, const unsigned char* b, unsigned size, vector<unsigned char>& out)
+{
+        out.clear();
+        unsigned last = 0;
+        unsigned i = 0;
+        while(i < size)
+        {
+                // Most of the state doesn't change from frame to frame, skip it a word at a time
+                uint64_t wa, wb;
+                if(i + 8 <= size && (memcpy(&wa, a + i, 8), memcpy(&wb, b + i, 8), wa == wb))
+                {
+                        i += 8;
+                        continue;
+                }
+                if(a[i] == b[i])
+                {
+                        ++i;
+                        continue;
+                }
+
+                unsigned start = i;
+                while(i < size && i - start < 255 && a[i] != b[i])
+                {
+                        ++i;
+                }
+
+                unsigned skip = start - last;
+                while(skip > 0xFFFF)
+                { // An unchanged stretch of XO-CHIP's memory past 4 KB can be longer than that
+                        out.push_back(0xFF);
+                        out.push_back(0xFF);
+                        out.push_back(0);
+                        skip -= 0xFFFF;
+                }
+                out.push_back(skip & 0xFF);
+                out.push_back(skip >> 8);
+                out.push_back(i - start);
+                for(unsigned j = start; j < i; ++j)
+                {
+                        out.push_back(a[j] ^ b[j]);
+                }
+                last = i;
+        }
+}
+
+static void applyDelta(unsigned char* state, const vector<unsigned char>& delta)
+{
+        unsigned pos = 0;
+        for(unsigned p = 0; p < delta.size(); )
+        {
+                pos += delta[p] | delta[p + 1] << 8;
+                unsigned length = delta[p + 2];
+                p += 3;
+                for(unsigned j = 0; j < length; ++j)
+                {
+                        state[pos + j] ^= delta[p + j];
+                }
+                pos += length;
+                p += length;
+        }
+}
+
+static const unsigned char zeroState[sizeof(Chip8State) + 0x10000] = {0}; // Keyframes are encoded against it, it's larger than any frame
+
+Chip8Rewind::Chip8Rewind(unsigned capacityFrames, unsigned interval)
+{
+        capacity = capacityFrames > 1 ? capacityFrames : 2;
+        keyframeInterval = interval > 0 ? interval : 1;
+        sinceKey = 0;
+        stored = 0;
+}
+
+void Chip8Rewind::push(const Chip8State& state, const vector<unsigned char>& upper)
+{ // Records state (and upper, XO-CHIP's memory past 4 KB, empty in the other modes) as the newest frame, dropping the oldest one when full
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&state);
+        next.assign(bytes, bytes + sizeof(Chip8State));
+        next.insert(next.end(), upper.begin(), upper.end());
+        if(next.size() != current.size())
+                clear(); // The machine changed mode: frames before that don't line up with this one
+
+        Frame frame;
+        if(!frames.empty())
+                encodeDelta(&next[0], &current[0], next.size(), frame.delta);
+
+        if(frames.empty() || ++sinceKey >= keyframeInterval)
+        {
+                encodeDelta(&next[0], zeroState, next.size(), frame.key);
+                sinceKey = 0;
+        }
+
+        stored += frame.delta.size() + frame.key.size();
+        frames.push_back(Frame());
+        frames.back().delta.swap(frame.delta);
+        frames.back().key.swap(frame.key);
+        current.swap(next);
+
+        if(frames.size() > capacity)
+        { // The new oldest frame's delta points at nothing now, but only ever gets applied going forward from a keyframe before it
+                stored -= frames.front().delta.size() + frames.front().key.size();
+                frames.pop_front();
+        }
+}
+
+void Chip8Rewind::dropNewest()
+{
+        stored -= frames.back().delta.size() + frames.back().key.size();
+        frames.pop_back();
+
+        sinceKey = 0;
+        for(unsigned i = frames.size(); i-- > 0 && frames[i].key.empty(); )
+        {
+                ++sinceKey;
+        }
+}
+
+bool Chip8Rewind::stepBack(Chip8State& state, vector<unsigned char>& upper)
+{ // Drops the newest frame and puts the one before it in state and upper, false if there's nothing to go back to
+        return rewind(1, state, upper) == 1;
+}
+
+unsigned Chip8Rewind::rewind(unsigned count, Chip8State& state, vector<unsigned char>& upper)
+{ // Goes back up to count frames, puts the frame landed on in state and upper and returns how far it went
+        if(frames.size() < 2)
+                return 0;
+        if(count > frames.size() - 1)
+                count = frames.size() - 1;
+
+        unsigned target = frames.size() - 1 - count;
+
+        // Walking back costs one delta per frame, starting over from the closest
+        // keyframe costs the keyframe plus one delta per frame after it
+        unsigned keyframe = target;
+        while(keyframe > 0 && frames[keyframe].key.empty())
+        {
+                --keyframe;
+        }
+
+        unsigned char* bytes = &current[0];
+        if(!frames[keyframe].key.empty() && target - keyframe + 1 < count)
+        {
+                memset(bytes, 0, current.size());
+                applyDelta(bytes, frames[keyframe].key);
+                for(unsigned i = keyframe + 1; i <= target; ++i)
+                {
+                        applyDelta(bytes, frames[i].delta);
+                }
+                while(frames.size() > target + 1)
+                {
+                        dropNewest();
+                }
+        } else
+        {
+                while(frames.size() > target + 1)
+                {
+                        applyDelta(bytes, frames.back().delta);
+                        dropNewest();
+                }
+        }
+
+        memcpy(&state, bytes, sizeof(Chip8State));
+        upper.assign(current.begin() + sizeof(Chip8State), current.end());
+        return count;
+}
+
+void Chip8Rewind::clear()
+{
+        frames.clear();
+        sinceKey = 0;
+        stored = 0;
+}
+
+unsigned Chip8Rewind::size() const
+{ // Number of frames held, the newest included
+        return frames.size();
+}
+
+size_t Chip8Rewind::bytes() const
+{ // Memory held by the encoded frames
+        return stored;
+}
@@ -0,0 +1,47 @@
+#ifndef REWIND_H
+
+#define REWIND_H
+
+#include <deque>
+#include <vector>
+
+#include "Chip8.h"
+
+// Keeps the last few seconds of machine states so play can be stepped
+// backwards. Each frame is stored as the run-length encoded XOR against the
+// frame before it, which is usually a handful of bytes; every
+// `keyframeInterval` frames a full (also run-length encoded) copy is kept as
+// well so jumping far back doesn't have to walk every frame in between. A frame
+// is a Chip8State followed by XO-CHIP's memory past 4 KB, which only machines in
+// that mode have, so the others are encoded from their 6 KB of state alone.
+class Chip8Rewind
+{
+private:
+        struct Frame
+        {
+                vector<unsigned char> delta; // XOR against the previous frame
+                vector<unsigned char> key;   // Whole state, only on keyframes
+        };
+
+        deque<Frame> frames;
+        vector<unsigned char> current; // The newest frame, decoded
+        vector<unsigned char> next;    // The frame being pushed, put together
+        unsigned capacity;
+        unsigned keyframeInterval;
+        unsigned sinceKey;  // Frames pushed since the newest keyframe
+        size_t stored;      // Bytes held by all deltas and keyframes
+
+        void dropNewest();
+public:
+        Chip8Rewind(unsigned capacityFrames = 60 * 10, unsigned interval = 60);
+
+        void push(const Chip8State& state, const vector<unsigned char>& upper);
+        bool stepBack(Chip8State& state, vector<unsigned char>& upper);
+        unsigned rewind(unsigned count, Chip8State& state, vector<unsigned char>& upper);
+        void clear();
+
+        unsigned size() const;
+        size_t bytes() const;
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include "RomList.h"
+#include <iostream>
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+void listROMs(const string& path, vector<string>& roms)
+{ // A directory contributes every regular file in it, anything else is taken as a ROM
+        struct stat info;
+        if(stat(path.c_str(), &info) != 0)
+        {
+                cerr << "Can't open " << path << endl;
+                return;
+        }
+        if(!S_ISDIR(info.st_mode))
+        {
+                roms.push_back(path);
+                return;
+        }
+
+        vector<string> found;
+        DIR* dir = opendir(path.c_str());
+        if(!dir)
+        { // Unreadable directory: it contributes nothing
+                cerr << "Can't open " << path << ": " << strerror(errno) << endl;
+                return;
+        }
+        for(struct dirent* entry = readdir(dir); entry; entry = readdir(dir))
+        {
+                string file = path + "/" + entry->d_name;
+                if(entry->d_name[0] != '.' && stat(file.c_str(), &info) == 0 && S_ISREG(info.st_mode))
+                        found.push_back(file);
+        }
+        closedir(dir);
+
+        sort(found.begin(), found.end());
+        roms.insert(roms.end(), found.begin(), found.end());
+}
+
+bool RomImage::read(const string& fileName)
+{ // Checks the size first, then maps the file and copies it out in one go. False, with the reason on cerr, if it can't be a ROM
+        int fd = open(fileName.c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+                cerr << "Can't open ROM " << fileName << ": " << strerror(errno) << endl;
+                return false;
+        }
+
+        struct stat info;
+        if(fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0 || info.st_size > LARGE_AREA)
+        {
+                cerr << fileName << " isn't a ROM: it has to be a file of 1 to " << LARGE_AREA << " bytes" << endl;
+                close(fd);
+                return false;
+        }
+
+        size_t length = info.st_size;
+        void* data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(data == MAP_FAILED)
+        {
+                cerr << "Can't read ROM " << fileName << ": " << strerror(errno) << endl;
+                return false;
+        }
+
+        name = fileName;
+        size = length;
+        bytes.assign(size <= SMALL_AREA ? SMALL_AREA : LARGE_AREA, 0);
+        memcpy(&bytes[0], data, size);
+        munmap(data, length);
+
+        hash = 14695981039346656037ULL;
+        for(unsigned i = 0; i < size; ++i)
+        {
+                hash ^= bytes[i];
+                hash *= 1099511628211ULL;
+        }
+        return true;
+}
+
+RomCache::~RomCache()
+{
+        for(multimap<uint64_t, RomImage*>::iterator i = byHash.begin(); i != byHash.end(); ++i)
+        {
+                delete i->second;
+        }
+}
+
+const RomImage* RomCache::load(const string& fileName)
+{ // Reads each path once; a file with the same contents as one read before gets that image
+        lock_guard<mutex> guard(lock);
+        map<string, const RomImage*>::iterator known = byPath.find(fileName);
+        if(known != byPath.end())
+                return known->second;
+
+        RomImage* image = new RomImage;
+        if(!image->read(fileName))
+        {
+                delete image;
+                return NULL;
+        }
+
+        typedef multimap<uint64_t, RomImage*>::iterator Iterator;
+        pair<Iterator, Iterator> same = byHash.equal_range(image->hash);
+        for(Iterator i = same.first; i != same.second; ++i)
+        {
+                if(i->second->size == image->size && i->second->bytes == image->bytes)
+                { // Same ROM under another name
+                        delete image;
+                        return byPath[fileName] = i->second;
+                }
+        }
+
+        byHash.insert(make_pair(image->hash, image));
+        return byPath[fileName] = image;
+}
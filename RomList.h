@@ -0,0 +1,51 @@
+#ifndef ROMLIST_H
+
+#define ROMLIST_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+// Appends the ROMs found at path to roms: a directory contributes every regular
+// file in it (sorted by name), anything else is taken as a ROM itself.
+void listROMs(const string& path, vector<string>& roms);
+
+// A ROM file read into memory, zero padded to a whole program area (the 4 KB
+// one, or XO-CHIP's 64 KB one for bigger files) so that loading it into a
+// machine is a single copy that also wipes whatever the last program left.
+struct RomImage
+{
+        static const unsigned PROGRAM_START = 0x200;
+        static const unsigned SMALL_AREA = 0x1000 - PROGRAM_START;  // 3584 bytes, CHIP-8 and SUPER-CHIP
+        static const unsigned LARGE_AREA = 0x10000 - PROGRAM_START; // XO-CHIP
+
+        string name;                 // Path it was first read from
+        vector<unsigned char> bytes; // SMALL_AREA or LARGE_AREA long
+        unsigned size;               // Length of the file
+        uint64_t hash;               // FNV-1a over the file, as Chip8Movie::hashROM
+
+        bool read(const string& fileName);
+};
+
+// Every ROM read so far, by path, with identical files sharing one image. Safe
+// to use from several threads; images stay valid as long as the cache.
+class RomCache
+{
+private:
+        mutex lock;
+        map<string, const RomImage*> byPath;
+        multimap<uint64_t, RomImage*> byHash; // Owns the images
+public:
+        RomCache() {}
+        ~RomCache();
+        RomCache(const RomCache&) = delete;
+        RomCache& operator=(const RomCache&) = delete;
+
+        const RomImage* load(const string& fileName); // NULL if the file isn't a ROM
+};
+
+#endif
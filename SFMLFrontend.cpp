@@ -0,0 +1,151 @@
+#include "SFMLFrontend.h"
+#include <string.h>
+
+const sf::Keyboard::Key SFMLInput::keyNum[16] =
+        {
+                sf::Keyboard::X, sf::Keyboard::Num1, sf::Keyboard::Num2,
+                sf::Keyboard::Num3, sf::Keyboard::Q, sf::Keyboard::W,
+                sf::Keyboard::E, sf::Keyboard::A, sf::Keyboard::S,
+                sf::Keyboard::D, sf::Keyboard::Z, sf::Keyboard::C,
+                sf::Keyboard::Num4, sf::Keyboard::R, sf::Keyboard::F,
+                sf::Keyboard::V
+        };
+
+unsigned short SFMLInput::pollKeys()
+{
+        unsigned short keys = 0;
+        for(int i = 0; i < 16; ++i)
+        {
+                if(sf::Keyboard::isKeyPressed(keyNum[i]))
+                        keys |= 1 << i;
+        }
+        return keys;
+}
+
+SFMLAudio::SFMLAudio()
+        : head(0), tail(0), phase(0)
+{
+        initialize(1, SAMPLE_RATE);
+        play(); // Runs for good, silent whenever no beep is queued
+}
+
+SFMLAudio::~SFMLAudio()
+{
+        stop(); // The audio thread has to be gone before the queue is
+}
+
+void SFMLAudio::tick(bool beep)
+{ // Emulation side: queue one tick, dropped when the audio thread is too far behind (turbo)
+        unsigned t = tail.load(memory_order_relaxed);
+        if(t - head.load(memory_order_acquire) == QUEUE)
+                return;
+
+        queue[t % QUEUE] = beep;
+        tail.store(t + 1, memory_order_release);
+}
+
+bool SFMLAudio::onGetData(Chunk& data)
+{ // Audio thread: one tick's worth of samples per call
+        unsigned h = head.load(memory_order_relaxed);
+        unsigned t = tail.load(memory_order_acquire);
+        if(t - h > MAX_LAG)
+                h = t - MAX_LAG; // The emulation got ahead of the sound card, catch up
+
+        bool beep = false; // An empty queue (paused, idle) plays silence
+        if(h != t)
+        {
+                beep = queue[h % QUEUE];
+                head.store(h + 1, memory_order_release);
+        }
+
+        for(unsigned i = 0; i < TICK_SAMPLES; ++i)
+        {
+                samples[i] = beep ? (phase < SAMPLE_RATE ? AMPLITUDE : -AMPLITUDE) : 0;
+                phase = (phase + PITCH * 2) % (SAMPLE_RATE * 2);
+        }
+
+        data.samples = samples;
+        data.sampleCount = TICK_SAMPLES;
+        return true; // Never ends
+}
+
+void SFMLAudio::onSeek(sf::Time)
+{
+}
+
+const sf::Uint8 SFMLVideo::palette[4] = { 0, 255, 170, 85 };
+
+SFMLVideo::SFMLVideo(sf::RenderWindow& target, int side)
+        : window(target), side(side)
+{
+        texture.create(128, 64);
+        sprite.setTexture(texture);
+        sprite.setTextureRect(sf::IntRect(0, 0, 64, 32));
+        sprite.setScale(side, side);
+
+        // Start out all black, both in the texture and in what we think it holds
+        for(int i = 0; i < 128 * 64; ++i)
+        {
+                pixels[i * 4 + 0] = 0;
+                pixels[i * 4 + 1] = 0;
+                pixels[i * 4 + 2] = 0;
+                pixels[i * 4 + 3] = 255;
+        }
+        texture.update(pixels);
+        memset(shown, 0, sizeof(shown));
+        shownWidth = 64;
+        shownPlanes = 1;
+}
+
+void SFMLVideo::drawFrame(const Chip8Frame& frame)
+{ // Uses state of machine to render data
+        uint64_t dirty = 0;
+        if (frame.width != shownWidth || frame.planes != shownPlanes) {
+                // Resolution switch: the same window, pixels half or twice the size, and everything redrawn
+                shownWidth = frame.width;
+                shownPlanes = frame.planes;
+                sprite.setTextureRect(sf::IntRect(0, 0, frame.width, frame.height));
+                sprite.setScale(side * 64.f / frame.width, side * 64.f / frame.width);
+                dirty = ~0ull >> (64 - frame.height);
+        }
+
+        // Find the rows that differ from what the texture already shows
+        const int stride = frame.stride();
+        for (int y = 0; y < frame.height; ++y) {
+                for (int p = 0; p < frame.planes; ++p) {
+                        for (int w = 0; w < stride; ++w) {
+                                int i = p * Chip8Frame::PLANE_WORDS + y * stride + w;
+                                if (frame.rows[i] != shown[i])
+                                        dirty |= 1ull << y;
+                        }
+                }
+        }
+        if (!dirty)
+                return; // Same picture as on screen, nothing to do
+
+        // Expand only the dirty rows into RGBA
+        int first = frame.height - 1, last = 0;
+        for (int y = 0; y < frame.height; ++y) {
+                if (!(dirty & (1ull << y)))
+                        continue;
+                for (int x = 0; x < frame.width; ++x) {
+                        sf::Uint8 value = palette[frame.color(x, y)];
+                        sf::Uint8* p = &pixels[(y * frame.width + x) * 4];
+                        p[0] = p[1] = p[2] = value;
+                }
+                for (int p = 0; p < frame.planes; ++p) {
+                        for (int w = 0; w < stride; ++w) {
+                                int i = p * Chip8Frame::PLANE_WORDS + y * stride + w;
+                                shown[i] = frame.rows[i];
+                        }
+                }
+                first = y < first ? y : first;
+                last = y;
+        }
+
+        // One upload of the band of rows that changed, then one draw call
+        texture.update(&pixels[first * frame.width * 4], frame.width, last - first + 1, 0, first);
+        window.clear();
+        window.draw(sprite);
+        window.display(); // Now we display our result
+}
@@ -0,0 +1,74 @@
+#ifndef SFMLFRONTEND_H
+
+#define SFMLFRONTEND_H
+
+#include <SFML/Graphics.hpp>
+#include <SFML/Audio.hpp>
+
+#include <atomic>
+
+#include "Frontend.h"
+
+using namespace std;
+
+// Reads the 16 keys from the physical keyboard
+class SFMLInput : public Chip8Input
+{
+private:
+        static const sf::Keyboard::Key keyNum[16];
+public:
+        unsigned short pollKeys();
+};
+
+// Streams the beep as a square wave generated one tick at a time. The
+// emulation pushes each tick's beep into a lock-free queue that the audio
+// thread drains, so the tone lasts exactly as many ticks as the sound timer.
+class SFMLAudio : public Chip8Audio, private sf::SoundStream
+{
+private:
+        static const unsigned SAMPLE_RATE = 44100;
+        static const unsigned TICK_SAMPLES = SAMPLE_RATE / 60;
+        static const unsigned PITCH = 440;
+        static const int AMPLITUDE = 8000;
+
+        static const unsigned QUEUE = 64;   // Ticks the emulation can get ahead, a power of two
+        static const unsigned MAX_LAG = 4;  // Ticks queued beyond this are skipped to keep latency down
+
+        unsigned char queue[QUEUE];
+        atomic<unsigned> head; // Next tick to play, only moved by the audio thread
+        atomic<unsigned> tail; // Next free slot, only moved by the emulation
+
+        sf::Int16 samples[TICK_SAMPLES];
+        unsigned phase; // Position in the square wave, one period being SAMPLE_RATE * 2
+
+        bool onGetData(Chunk& data);
+        void onSeek(sf::Time);
+public:
+        SFMLAudio();
+        ~SFMLAudio();
+        void tick(bool beep);
+};
+
+// Renders VRAM as one texture (64x32 or 128x64), scaled up to the window and
+// drawn in a single call
+class SFMLVideo : public Chip8Video
+{
+private:
+        static const sf::Uint8 palette[4]; // Grey level for each combination of the two planes
+
+        sf::RenderWindow& window;
+        int side; // Window pixels per 64x32 pixel
+
+        sf::Texture texture;
+        sf::Sprite sprite;
+
+        sf::Uint8 pixels[128 * 64 * 4]; // RGBA copy of what the texture holds
+        uint64_t shown[2 * Chip8Frame::PLANE_WORDS]; // Rows as they were last uploaded
+        int shownWidth;
+        int shownPlanes;
+public:
+        SFMLVideo(sf::RenderWindow& target, int side);
+        void drawFrame(const Chip8Frame& frame);
+};
+
+#endif
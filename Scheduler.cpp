@@ -0,0 +1,65 @@
+#include "Scheduler.h"
+#include <thread>
+
+Chip8Scheduler::Chip8Scheduler(Chip8& machine, unsigned hz)
+        : chip8(machine), cpuHz(hz), turbo(false), credit(0), overshoot(0)
+{
+        deadline = Clock::now();
+}
+
+void Chip8Scheduler::setCpuHz(unsigned hz)
+{ // Instructions per emulated second
+        cpuHz = hz;
+}
+
+unsigned Chip8Scheduler::getCpuHz() const
+{
+        return cpuHz;
+}
+
+void Chip8Scheduler::setTurbo(bool on)
+{ // Uncapped: frames run back to back without waiting for the wall clock
+        turbo = on;
+        deadline = Clock::now();
+}
+
+bool Chip8Scheduler::getTurbo() const
+{
+        return turbo;
+}
+
+unsigned long Chip8Scheduler::runFrame()
+{ // Runs one 60 Hz frame worth of instructions and ticks the timers, returns how many instructions ran
+        credit += cpuHz;
+        long budget = credit / TIMER_HZ - overshoot;
+        credit %= TIMER_HZ;
+
+        unsigned long executed = 0;
+        if(budget > 0)
+                executed = chip8.run(budget);
+        overshoot = (long) executed - budget; // The block engine can run a little past its budget
+
+        chip8.tickTimers();
+        return executed;
+}
+
+void Chip8Scheduler::waitForNextFrame()
+{ // Sleeps until the next frame is due
+        if(turbo)
+                return;
+
+        deadline += chrono::microseconds(1000000 / TIMER_HZ);
+
+        Clock::time_point now = Clock::now();
+        if(deadline < now - chrono::milliseconds(100))
+        { // Far behind (the window was dragged, the host stalled...), don't try to catch up
+                deadline = now;
+                return;
+        }
+        this_thread::sleep_until(deadline);
+}
+
+void Chip8Scheduler::resync()
+{ // Starts counting frames from now, after the caller was away (blocked on input, paused...)
+        deadline = Clock::now();
+}
@@ -0,0 +1,40 @@
+#ifndef SCHEDULER_H
+
+#define SCHEDULER_H
+
+#include <chrono>
+
+#include "Chip8.h"
+
+// Drives a Chip8 in 60 Hz frames: each frame runs a batch of instructions
+// (cpuHz / 60 of them), ticks the timers once and then, unless in turbo mode,
+// sleeps until the frame is due so the host CPU idles in between.
+class Chip8Scheduler
+{
+private:
+        typedef chrono::steady_clock Clock;
+
+        Chip8& chip8;
+        unsigned cpuHz;
+        bool turbo;
+
+        unsigned credit;     // cpuHz / 60 rarely divides evenly, the remainder carries over
+        long overshoot;      // Instructions the last frame ran past its budget
+        Clock::time_point deadline;
+public:
+        static const unsigned TIMER_HZ = 60;
+        static const unsigned DEFAULT_CPU_HZ = 500;
+
+        Chip8Scheduler(Chip8& machine, unsigned hz = DEFAULT_CPU_HZ);
+
+        void setCpuHz(unsigned hz);
+        unsigned getCpuHz() const;
+        void setTurbo(bool on);
+        bool getTurbo() const;
+
+        unsigned long runFrame();
+        void waitForNextFrame();
+        void resync();
+};
+
+#endif
@@ -0,0 +1,18 @@
+#include "ScriptedInput.h"
+
+ScriptedInput::ScriptedInput(unsigned seed, unsigned holdPolls)
+        : state(seed ? seed : 1), hold(holdPolls ? holdPolls : 1), polls(0), keys(0)
+{
+}
+
+unsigned short ScriptedInput::pollKeys()
+{
+        if(++polls % hold == 0)
+        { // xorshift32, then half the time nothing and otherwise a single key
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                keys = (state & 0x10) ? 0 : 1 << (state >> 28);
+        }
+        return keys;
+}
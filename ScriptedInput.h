@@ -0,0 +1,22 @@
+#ifndef SCRIPTEDINPUT_H
+
+#define SCRIPTEDINPUT_H
+
+#include "Frontend.h"
+
+// Deterministic stand-in for a player: every `hold` polls it lets go of
+// everything or presses one key picked by a small seeded generator. The same
+// seed always produces the same sequence of key states.
+class ScriptedInput : public Chip8Input
+{
+private:
+        unsigned state;
+        unsigned hold;
+        unsigned polls;
+        unsigned short keys;
+public:
+        ScriptedInput(unsigned seed = 1, unsigned holdPolls = 30);
+        unsigned short pollKeys();
+};
+
+#endif
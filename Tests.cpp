@@ -0,0 +1,730 @@
+#include "Chip8.h"
+#include "Lockstep.h"
+#include "Rewind.h"
+#include "Pool.h"
+#include "Frontend.h"
+#include "Movie.h"
+#include "RomList.h"
+#include "Scheduler.h"
+#include "ScriptedInput.h"
+#include "Trace.h"
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdio.h>
+
+// Regression tests for the core, run by 'make test'. Every test builds its ROM
+// in memory, runs it headless and checks where the machine ended up. Prints
+// what failed on cerr and exits non-zero if anything did.
+
+static unsigned failures = 0;
+
+static void check(bool passed, const string& test, const string& what)
+{
+        if(!passed)
+        {
+                cerr << "FAILED " << test << ": " << what << endl;
+                ++failures;
+        }
+}
+
+static RomImage makeROM(const string& name, const vector<unsigned char>& program)
+{ // program is loaded at 0x200, as a ROM file would be
+        RomImage image;
+        image.name = name;
+        image.size = program.size();
+        image.bytes.assign(program.size() > RomImage::SMALL_AREA ? RomImage::LARGE_AREA : RomImage::SMALL_AREA, 0);
+        memcpy(&image.bytes[0], &program[0], program.size());
+        image.hash = 0;
+        return image;
+}
+
+static void putOpcode(vector<unsigned char>& program, unsigned short address, unsigned short op)
+{
+        program[address - RomImage::PROGRAM_START] = op >> 8;
+        program[address - RomImage::PROGRAM_START + 1] = op & 0xFF;
+}
+
+static void checkEngines(const RomImage& rom, unsigned short stopsAt, unsigned long instructions)
+{ // Every engine has to stop the machine on opcode 0000 at the same pc after the same number of instructions, lockstep lanes included
+        const Chip8::Engine engines[] = {Chip8::INTERPRETER, Chip8::BLOCKS, Chip8::JIT};
+        const char* engineNames[] = {"interpreter", "blocks", "jit"};
+        for(unsigned e = 0; e < 3; ++e)
+        {
+                string test = rom.name + " (" + engineNames[e] + ")";
+                Chip8* chip8 = new Chip8;
+                chip8->setSeed(1);
+                chip8->setEngine(engines[e]);
+                check(chip8->loadROM(rom), test, "didn't load");
+                unsigned long executed = chip8->run(100000);
+                check(!chip8->getChipState(), test, "machine still running");
+                check(chip8->getPC() == stopsAt, test, "stopped at the wrong pc");
+                unsigned short opcode = 0xFFFF;
+                check(chip8->getUnknownOpcode(opcode) && opcode == 0, test, "didn't record the unknown opcode it stopped on");
+                if(instructions)
+                        check(executed == instructions, test, "ran a different number of instructions");
+                delete chip8;
+        }
+
+        string test = rom.name + " (lockstep)";
+        Chip8Lockstep lockstep(2);
+        check(lockstep.loadROM(rom), test, "didn't load");
+        lockstep.runFrames(1000);
+        for(unsigned lane = 0; lane < lockstep.getLanes(); ++lane)
+        {
+                check(!lockstep.getChipState(lane), test, "lane still running");
+                check(lockstep.getPC(lane) == stopsAt, test, "lane stopped at the wrong pc");
+                unsigned short opcode = 0xFFFF;
+                check(lockstep.getUnknownOpcode(lane, opcode) && opcode == 0, test, "lane didn't record the unknown opcode it stopped on");
+        }
+}
+
+static void runOffTheEnd()
+{ // A ROM filling all of memory with 6000 runs past 0xFFE: the machine stops there instead of decoding outside memory
+        vector<unsigned char> program(RomImage::SMALL_AREA);
+        for(unsigned a = RomImage::PROGRAM_START; a < 0x1000; a += 2)
+        {
+                putOpcode(program, a, 0x6000);
+        }
+        checkEngines(makeROM("off the end", program), 0x1000, RomImage::SMALL_AREA / 2 + 1);
+}
+
+static void skipOffTheEnd()
+{ // A skip at 0xFFC lands on 0x1000 without passing 0xFFE
+        vector<unsigned char> program(RomImage::SMALL_AREA);
+        putOpcode(program, 0x200, 0x1FFC);
+        putOpcode(program, 0xFFC, 0x3000); // V0 is 0, skip
+        checkEngines(makeROM("skip off the end", program), 0x1000, 3);
+}
+
+static void writeWrapsRound()
+{ // FX33 with I = 0xFFE writes 0xFFE, 0xFFF and 0x000: the 00EE decoded at 0xFFE before has to go
+        vector<unsigned char> program(RomImage::SMALL_AREA);
+        putOpcode(program, 0x200, 0x2FFE); // Call 0xFFE, which returns
+        putOpcode(program, 0x202, 0xAFFE); // I = 0xFFE
+        putOpcode(program, 0x204, 0x6000); // V0 = 0
+        putOpcode(program, 0x206, 0xF033); // BCD of V0 at I: 0xFFE now holds 0000
+        putOpcode(program, 0x208, 0x2FFE); // Call 0xFFE again, which should stop the machine
+        putOpcode(program, 0x20A, 0x120A); // Where a stale 00EE would end up
+        putOpcode(program, 0xFFE, 0x00EE);
+        checkEngines(makeROM("write wrapping round", program), 0xFFE, 0);
+}
+
+static bool reaches(Chip8* chip8, unsigned short loop)
+{ // Runs the machine for a while, true if it ended up going round the loop at `loop`
+        chip8->run(1000);
+        return chip8->getPC() == loop;
+}
+
+static void xochipUpperMemory()
+{ // XO-CHIP's memory past 4 KB is kept outside Chip8State: a ROM's bytes there, snapshots, save files and rewinding all have to bring it along
+        vector<unsigned char> program(0x8001 - RomImage::PROGRAM_START);
+        putOpcode(program, 0x200, 0xF000); // I = 0x8000
+        putOpcode(program, 0x202, 0x8000);
+        putOpcode(program, 0x204, 0xF065); // V0 = memory[0x8000]
+        putOpcode(program, 0x206, 0x3042); // Done once it holds 0x42
+        putOpcode(program, 0x208, 0x1204);
+        putOpcode(program, 0x20A, 0x120A);
+        program[0x8000 - RomImage::PROGRAM_START] = 0x42;
+        RomImage rom = makeROM("XO-CHIP upper memory", program);
+
+        Chip8* chip8 = new Chip8;
+        chip8->setMode(Chip8::XOCHIP);
+        check(chip8->loadROM(rom), rom.name, "didn't load");
+        Chip8State state;
+        vector<unsigned char> upper;
+        chip8->saveState(state, upper);
+        check(chip8->saveState("chip-8-tests.state"), rom.name, "couldn't write a save state");
+        check(reaches(chip8, 0x20A), rom.name, "didn't read the ROM past 4 KB");
+
+        Chip8* restored = new Chip8;
+        restored->loadState(state, upper);
+        check(reaches(restored, 0x20A), rom.name, "snapshot lost memory past 4 KB");
+        restored->loadState(state);
+        check(!reaches(restored, 0x20A), rom.name, "snapshot without memory past 4 KB kept the old one");
+        check(restored->loadState("chip-8-tests.state") && reaches(restored, 0x20A), rom.name, "save state file lost memory past 4 KB");
+        remove("chip-8-tests.state");
+
+        Chip8Rewind rewind;
+        restored->loadState(state, upper);
+        rewind.push(state, upper);
+        restored->run(1000);
+        restored->saveState(state, upper);
+        rewind.push(state, upper);
+        check(rewind.stepBack(state, upper), rom.name, "nothing to rewind to");
+        restored->loadState(state, upper);
+        check(restored->getPC() == 0x200 && reaches(restored, 0x20A), rom.name, "rewinding lost memory past 4 KB");
+
+        delete restored;
+        delete chip8;
+}
+
+static void xochipCodePastEnd()
+{ // XO-CHIP runs on past 0xFFE into the memory beyond 4 KB: long I loads, skips over them and calls from there all work, on every engine
+        vector<unsigned char> program(0x1010 - RomImage::PROGRAM_START);
+        putOpcode(program, 0x200, 0x1FFE);
+        putOpcode(program, 0xFFE, 0x6042); // V0 = 0x42, on to 0x1000
+        putOpcode(program, 0x1000, 0x7001);
+        putOpcode(program, 0x1002, 0xF000); // I = 0xABCD
+        putOpcode(program, 0x1004, 0xABCD);
+        putOpcode(program, 0x1006, 0x3043); // V0 is 0x43: skip all 4 bytes of the next one
+        putOpcode(program, 0x1008, 0xF000);
+        putOpcode(program, 0x100A, 0x0000);
+        putOpcode(program, 0x100C, 0x2FF0); // Call 0xFF0, which returns
+        putOpcode(program, 0x100E, 0x1FF2);
+        putOpcode(program, 0xFF0, 0x00EE);
+        putOpcode(program, 0xFF2, 0x1FF2);
+        RomImage rom = makeROM("XO-CHIP code past 4 KB", program);
+
+        const Chip8::Engine engines[] = {Chip8::INTERPRETER, Chip8::BLOCKS, Chip8::JIT};
+        const char* engineNames[] = {"interpreter", "blocks", "jit"};
+        for(unsigned e = 0; e < 3; ++e)
+        {
+                string test = rom.name + " (" + engineNames[e] + ")";
+                Chip8* chip8 = new Chip8;
+                chip8->setMode(Chip8::XOCHIP);
+                chip8->setEngine(engines[e]);
+                check(chip8->loadROM(rom), test, "didn't load");
+                chip8->run(1000);
+                Chip8State state;
+                chip8->saveState(state);
+                check(chip8->getChipState(), test, "machine stopped");
+                check(state.pc == 0xFF2, test, "didn't come back from past 4 KB");
+                check(state.V[0] == 0x43 && state.I == 0xABCD, test, "ran something else past 4 KB");
+                delete chip8;
+        }
+}
+
+class KeySequence : public Chip8Input
+{ // Hands out the given key masks one poll at a time, then nothing
+private:
+        vector<unsigned short> keys;
+        size_t next;
+public:
+        KeySequence(const vector<unsigned short>& masks) : keys(masks), next(0) {}
+        unsigned short pollKeys() { return next < keys.size() ? keys[next++] : 0; }
+};
+
+static void waitForPress()
+{ // FX0A takes only a key pressed while it waits: not one let go of, nor one held since before, which counts again once pressed anew
+        vector<unsigned char> program(0x0A);
+        putOpcode(program, 0x200, 0xF00A); // V0 = key
+        putOpcode(program, 0x202, 0x8200); // V2 = V0
+        putOpcode(program, 0x204, 0xF10A); // V1 = key
+        putOpcode(program, 0x206, 0xF30A); // V3 = key
+        putOpcode(program, 0x208, 0x1208);
+        RomImage rom = makeROM("FX0A waiting for a press", program);
+
+        // Ticks: 3 down, still down, let go, up, down again, 7 down with 3 still held
+        const unsigned short ticks[] = {1 << 3, 1 << 3, 0, 0, 1 << 3, 1 << 3 | 1 << 7};
+        KeySequence input(vector<unsigned short>(ticks, ticks + 6));
+        Chip8* chip8 = new Chip8;
+        chip8->setInput(&input);
+        check(chip8->loadROM(rom), rom.name, "didn't load");
+        const unsigned short waits[] = {0x200, 0x204, 0x206};
+        unsigned left[3] = {0, 0, 0}; // Frame each wait was left on
+        for(unsigned frame = 1; frame <= 8; ++frame)
+        {
+                chip8->run(10);
+                chip8->tickTimers();
+                for(unsigned w = 0; w < 3; ++w)
+                {
+                        if(!left[w] && chip8->getPC() > waits[w])
+                                left[w] = frame;
+                }
+        }
+        Chip8State state;
+        chip8->saveState(state);
+        check(left[0] == 2 && state.V[2] == 3, rom.name, "first press missed");
+        check(left[1] == 6 && state.V[1] == 3, rom.name, "a key let go of counted as a press");
+        check(left[2] == 7 && state.V[3] == 7, rom.name, "a key held since before counted as a press");
+        delete chip8;
+}
+
+static void movieReplay()
+{ // A movie recorded from a scripted player plays back to the same frame on a machine set up as it says (the engine included:
+  // blocks run whole, so where the ticks fall between instructions depends on it)
+        const char* roms[] = {"c8games/BRIX", "c8games/TICTAC", "c8games/GUESS"};
+        const Chip8::Engine engines[] = {Chip8::INTERPRETER, Chip8::BLOCKS, Chip8::JIT};
+        const char* engineNames[] = {"interpreter", "blocks", "jit"};
+        RomCache cache;
+        for(unsigned r = 0; r < 3; ++r)
+        {
+                const RomImage* rom = cache.load(roms[r]);
+                check(rom != NULL, roms[r], "couldn't read the ROM");
+                if(!rom)
+                        continue;
+
+                for(unsigned e = 0; e < 3; ++e)
+                {
+                        string test = string("movie of ") + roms[r] + " (" + engineNames[e] + ")";
+                        Chip8Movie movie;
+                        movie.romHash = rom->hash;
+                        movie.seed = 7;
+                        movie.cpuHz = 1000;
+                        movie.engine = engines[e];
+                        movie.mode = Chip8::CHIP8;
+                        ScriptedInput script(movie.seed, 20);
+                        MovieRecorder recorder(movie, &script);
+                        Chip8* recording = new Chip8;
+                        recording->setSeed(movie.seed);
+                        recording->setEngine(engines[e]);
+                        recording->setInput(&recorder);
+                        recording->loadROM(*rom);
+                        Chip8Scheduler scheduler(*recording, movie.cpuHz);
+                        scheduler.setTurbo(true);
+                        for(unsigned frame = 0; frame < 600 && recording->getChipState(); ++frame)
+                        {
+                                scheduler.runFrame();
+                        }
+                        check(movie.save("chip-8-tests.movie"), test, "couldn't write the movie");
+
+                        Chip8Movie loaded;
+                        check(loaded.load("chip-8-tests.movie") && loaded.keys == movie.keys, test, "movie came back different");
+                        remove("chip-8-tests.movie");
+                        MoviePlayer player(loaded);
+                        Chip8* replaying = new Chip8;
+                        replaying->setSeed(loaded.seed);
+                        replaying->setEngine((Chip8::Engine) loaded.engine);
+                        replaying->setInput(&player);
+                        replaying->loadROM(*rom);
+                        Chip8Scheduler replay(*replaying, loaded.cpuHz);
+                        replay.setTurbo(true);
+                        while(!player.finished() && replaying->getChipState())
+                        {
+                                replay.runFrame();
+                        }
+                        check(replaying->getFrame().hash() == recording->getFrame().hash(), test, "replay drew something else");
+                        check(replaying->getPC() == recording->getPC(), test, "replay ended somewhere else");
+                        delete replaying;
+                        delete recording;
+                }
+        }
+}
+
+static vector<char> readFile(const string& fileName)
+{
+        ifstream file(fileName, ios::binary);
+        return vector<char>(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+}
+
+static void runFrames(Chip8Scheduler& scheduler, unsigned frames)
+{
+        for(unsigned f = 0; f < frames; ++f)
+        {
+                scheduler.runFrame();
+        }
+}
+
+static void saveAndLoad()
+{ // A CHIP-8 machine saved mid-game, to a snapshot or to a file, carries on from where it was: same frame and pc as the machine it was saved from,
+  // and saving it again gives the same file
+        RomCache cache;
+        const RomImage* rom = cache.load("c8games/TETRIS");
+        check(rom != NULL, "save states", "couldn't read c8games/TETRIS");
+        if(!rom)
+                return;
+
+        ScriptedInput input(3);
+        Chip8* original = new Chip8;
+        original->setSeed(3);
+        original->setInput(&input);
+        original->loadROM(*rom);
+        Chip8Scheduler scheduler(*original, 1000);
+        runFrames(scheduler, 300);
+        Chip8State state;
+        original->saveState(state);
+        check(original->saveState("chip-8-tests.state"), "save states", "couldn't write a save state");
+        runFrames(scheduler, 300);
+
+        for(unsigned fromFile = 0; fromFile < 2; ++fromFile)
+        {
+                string test = fromFile ? "save state file" : "snapshot";
+                ScriptedInput sameInput(3);
+                for(unsigned tick = 0; tick < 300; ++tick)
+                {
+                        sameInput.pollKeys(); // Where the original's player is by now
+                }
+                Chip8* restored = new Chip8;
+                restored->setInput(&sameInput);
+                restored->loadROM(*rom);
+                if(fromFile)
+                {
+                        check(restored->loadState("chip-8-tests.state"), test, "didn't load");
+                        check(restored->saveState("chip-8-tests-again.state") && readFile("chip-8-tests-again.state") == readFile("chip-8-tests.state"),
+                              test, "saving it again gave another file");
+                        remove("chip-8-tests-again.state");
+                } else
+                {
+                        restored->loadState(state);
+                }
+                check(restored->getPC() == state.pc, test, "restored somewhere else");
+                Chip8Scheduler carryOn(*restored, 1000);
+                runFrames(carryOn, 300);
+                check(restored->getFrame().hash() == original->getFrame().hash(), test, "went on to draw something else");
+                check(restored->getPC() == original->getPC(), test, "went on to end somewhere else");
+                delete restored;
+        }
+        remove("chip-8-tests.state");
+        delete original;
+}
+
+static void rewindFrames()
+{ // Rewinding lands on exactly the state pushed that many frames back, however far it is from a keyframe, and no further back than the buffer holds
+        RomCache cache;
+        const RomImage* rom = cache.load("c8games/TETRIS");
+        check(rom != NULL, "rewind", "couldn't read c8games/TETRIS");
+        if(!rom)
+                return;
+
+        ScriptedInput input(5);
+        Chip8* chip8 = new Chip8;
+        chip8->setSeed(5);
+        chip8->setInput(&input);
+        chip8->loadROM(*rom);
+        Chip8Scheduler scheduler(*chip8, 1000);
+        Chip8Rewind rewind(120, 30);
+        vector<Chip8State> pushed(200);
+        vector<unsigned char> upper;
+        for(unsigned f = 0; f < 200; ++f)
+        {
+                scheduler.runFrame();
+                chip8->saveState(pushed[f], upper);
+                rewind.push(pushed[f], upper);
+        }
+        check(rewind.size() == 120, "rewind", "kept the wrong number of frames");
+        check(rewind.bytes() < 10 * sizeof(Chip8State), "rewind", "frames aren't delta-encoded");
+
+        Chip8State state;
+        check(rewind.stepBack(state, upper) && memcmp(&state, &pushed[198], sizeof(state)) == 0, "rewind", "stepping back landed on another frame");
+        check(rewind.rewind(10, state, upper) == 10 && memcmp(&state, &pushed[188], sizeof(state)) == 0, "rewind", "rewinding 10 frames landed on another one");
+        check(rewind.rewind(1000, state, upper) == 108 && memcmp(&state, &pushed[80], sizeof(state)) == 0, "rewind", "rewinding too far didn't stop at the oldest frame");
+        check(!rewind.stepBack(state, upper), "rewind", "stepped back past the oldest frame");
+
+        ScriptedInput replay(5);
+        for(unsigned tick = 0; tick <= 80; ++tick)
+        {
+                replay.pollKeys(); // Where the player was at that frame
+        }
+        chip8->setInput(&replay);
+        chip8->loadState(state, upper); // Carries on from there as it did the first time round
+        Chip8Scheduler carryOn(*chip8, 1000); // 81 frames in, the first scheduler's credit was back to 0 too
+        carryOn.runFrame();
+        chip8->saveState(state, upper);
+        check(memcmp(state.memory, pushed[81].memory, sizeof(state.memory)) == 0 && state.pc == pushed[81].pc, "rewind", "didn't carry on from the frame rewound to");
+        delete chip8;
+}
+
+static void schedulerCarry()
+{ // 1000 Hz doesn't divide into 60 frames and the block engines run whole blocks past a frame's budget: the scheduler carries both over,
+  // so after any number of frames the instructions run are never more than a block off 1000 per second
+        vector<unsigned char> program(0x102);
+        for(unsigned a = 0x200; a < 0x300; a += 2)
+        {
+                putOpcode(program, a, 0x7001); // Straight-line, no loop for fast-forwarding to skip
+        }
+        putOpcode(program, 0x300, 0x1200);
+        RomImage rom = makeROM("scheduler", program);
+        const unsigned BLOCK = 64; // Longest block, Chip8::MAX_BLOCK_LENGTH
+
+        const Chip8::Engine engines[] = {Chip8::INTERPRETER, Chip8::BLOCKS, Chip8::JIT};
+        const char* engineNames[] = {"interpreter", "blocks", "jit"};
+        for(unsigned e = 0; e < 3; ++e)
+        {
+                string test = rom.name + " (" + engineNames[e] + ")";
+                Chip8* chip8 = new Chip8;
+                chip8->setEngine(engines[e]);
+                chip8->loadROM(rom);
+                Chip8Scheduler scheduler(*chip8, 1000);
+                unsigned long total = 0;
+                bool onTime = true;
+                for(unsigned frame = 1; frame <= 600; ++frame)
+                {
+                        total += scheduler.runFrame();
+                        unsigned long due = frame * 1000 / 60;
+                        onTime = onTime && total >= due && total < due + (engines[e] == Chip8::INTERPRETER ? 1 : BLOCK);
+                }
+                check(onTime, test, "instructions run drifted away from the clock");
+                delete chip8;
+        }
+}
+
+static void traceRing()
+{ // A full trace drops what's pushed and counts it, never overwrites; dumping frees the slots again, also where the ring wraps
+        Chip8Trace trace(2); // 4 records
+        for(uint16_t pc = 0x200; pc < 0x20C; pc += 2)
+        {
+                trace.push(pc, 0x6000 | pc >> 1, 0x300, 0, 0);
+        }
+        check(trace.getDropped() == 2, "trace", "didn't count the records dropped");
+        ostringstream text;
+        check(trace.dumpText(text) == 4, "trace", "dumped the wrong number of records");
+        check(text.str() == "PC 200 OP 6100 I 300 SP 0\nPC 202 OP 6101 I 300 SP 0\nPC 204 OP 6102 I 300 SP 0\nPC 206 OP 6103 I 300 SP 0\n",
+              "trace", "dumped something other than the oldest records");
+        check(trace.dumpText(text) == 0, "trace", "dumped the same records twice");
+
+        trace.push(0x400, 0x1400, 0, 1, 1); // Slots 0 and 1, popped at once
+        trace.push(0x402, 0x1402, 0, 1, 1);
+        check(trace.dumpText(text) == 2, "trace", "dumped the wrong number of records once emptied");
+        for(uint16_t pc = 0x300; pc < 0x306; pc += 2)
+        { // Slots 2, 3 and 0: written out in two runs, either side of where the ring wraps
+                trace.push(pc, 0x1000 | pc, 0, 1, 1);
+        }
+        ostringstream binary;
+        check(trace.dumpBinary(binary) == 3, "trace", "dumped the wrong number of records after wrapping");
+        string bytes = binary.str();
+        check(bytes.size() == 3 * sizeof(TraceRecord), "trace", "wrote the wrong number of bytes");
+        bool inOrder = bytes.size() == 3 * sizeof(TraceRecord);
+        for(unsigned r = 0; inOrder && r < 3; ++r)
+        {
+                TraceRecord record;
+                memcpy(&record, bytes.data() + r * sizeof(record), sizeof(record));
+                inOrder = record.pc == 0x300 + 2 * r && record.opcode == (0x1300 + 2 * r) && record.block == 1;
+        }
+        check(inOrder, "trace", "records came out of order after wrapping");
+        check(trace.getDropped() == 2, "trace", "dropped records with room to spare");
+}
+
+static bool sameMachine(const Chip8State& a, const Chip8State& b)
+{
+        return memcmp(a.V, b.V, sizeof a.V) == 0 && a.I == b.I && a.pc == b.pc;
+}
+
+static void enginesAgree()
+{ // Every engine runs c8games ROMs under a scripted player exactly as the interpreter does: the block engines run whole blocks, so an interpreter
+  // follows each of them with as many instructions as it ran every frame, while lockstep lanes are held to what the interpreter does under a scheduler
+        const char* roms[] = {"c8games/BRIX", "c8games/PONG", "c8games/TETRIS", "c8games/INVADERS", "c8games/BLINKY", "c8games/TICTAC"};
+        const unsigned FRAMES = 600, LANES = 4, HZ = 1000;
+        RomCache cache;
+        for(unsigned r = 0; r < 6; ++r)
+        {
+                const RomImage* rom = cache.load(roms[r]);
+                check(rom != NULL, roms[r], "couldn't read the ROM");
+                if(!rom)
+                        continue;
+
+                const Chip8::Engine engines[] = {Chip8::BLOCKS, Chip8::JIT};
+                const char* engineNames[] = {"blocks", "jit"};
+                for(unsigned e = 0; e < 2; ++e)
+                {
+                        string test = string(roms[r]) + " (" + engineNames[e] + ")";
+                        ScriptedInput leaderInput(9), followerInput(9);
+                        Chip8* leader = new Chip8;
+                        Chip8* follower = new Chip8;
+                        leader->setEngine(engines[e]);
+                        leader->setSeed(9);
+                        leader->setInput(&leaderInput);
+                        leader->loadROM(*rom);
+                        follower->setSeed(9);
+                        follower->setInput(&followerInput);
+                        follower->loadROM(*rom);
+                        bool same = true;
+                        for(unsigned frame = 0; frame < FRAMES && same; ++frame)
+                        {
+                                follower->run(leader->run(HZ / 60));
+                                leader->tickTimers();
+                                follower->tickTimers();
+                                Chip8State a, b;
+                                leader->saveState(a);
+                                follower->saveState(b);
+                                same = sameMachine(a, b) && leader->getFrame().hash() == follower->getFrame().hash();
+                        }
+                        check(same, test, "ran differently from the interpreter");
+                        delete follower;
+                        delete leader;
+                }
+
+                string test = string(roms[r]) + " (lockstep)";
+                Chip8Lockstep lockstep(LANES, HZ);
+                vector<ScriptedInput> laneInputs;
+                for(unsigned l = 0; l < LANES; ++l)
+                {
+                        laneInputs.push_back(ScriptedInput(l + 1));
+                }
+                for(unsigned l = 0; l < LANES; ++l)
+                {
+                        lockstep.setSeed(l, l + 1);
+                        lockstep.setInput(l, &laneInputs[l]);
+                }
+                lockstep.loadROM(*rom);
+                lockstep.runFrames(FRAMES);
+                for(unsigned l = 0; l < LANES; ++l)
+                {
+                        ScriptedInput input(l + 1);
+                        Chip8* chip8 = new Chip8;
+                        chip8->setSeed(l + 1);
+                        chip8->setInput(&input);
+                        chip8->loadROM(*rom);
+                        Chip8Scheduler scheduler(*chip8, HZ);
+                        runFrames(scheduler, FRAMES);
+                        Chip8State a, b;
+                        lockstep.saveState(l, a);
+                        chip8->saveState(b);
+                        check(sameMachine(a, b), test, "lane ran differently from the interpreter");
+                        check(lockstep.getFrame(l).hash() == chip8->getFrame().hash(), test, "lane drew something else");
+                        delete chip8;
+                }
+        }
+}
+
+static void pooledReset()
+{ // A machine back from the pool boots the next ROM as a new one would, nothing of the last ROM's memory or decoding left over
+        vector<unsigned char> full(RomImage::SMALL_AREA);
+        for(unsigned a = RomImage::PROGRAM_START; a < 0x1000; a += 2)
+        {
+                putOpcode(full, a, 0x6000);
+        }
+        RomImage first = makeROM("pool, first ROM", full);
+
+        vector<unsigned char> program(8);
+        putOpcode(program, 0x200, 0xA300); // Draw what's at 0x300, which the first ROM filled
+        putOpcode(program, 0x202, 0x6000);
+        putOpcode(program, 0x204, 0xD005);
+        putOpcode(program, 0x206, 0x1206);
+        RomImage second = makeROM("pool, second ROM", program);
+
+        const Chip8::Engine engines[] = {Chip8::INTERPRETER, Chip8::BLOCKS, Chip8::JIT};
+        for(unsigned e = 0; e < 3; ++e)
+        {
+                Chip8* fresh = new Chip8;
+                fresh->setEngine(engines[e]);
+                fresh->loadROM(second);
+                fresh->run(1000);
+
+                Chip8Pool pool;
+                Chip8* chip8 = pool.take(first, Chip8::CHIP8);
+                chip8->setEngine(engines[e]);
+                chip8->run(100000);
+                pool.giveBack(chip8);
+                chip8 = pool.take(second, Chip8::CHIP8);
+                check(chip8->getChipState(), second.name, "machine from the pool is off");
+                chip8->run(1000);
+                check(chip8->getPC() == fresh->getPC(), second.name, "pooled machine ended somewhere else");
+                check(chip8->getFrame().hash() == fresh->getFrame().hash(), second.name, "pooled machine drew something else");
+                check(pool.getBuilt() == 1, second.name, "pool built a second machine");
+                pool.giveBack(chip8);
+                delete fresh;
+        }
+}
+
+class PressAt : public Chip8Input
+{ // Holds `pressed` down from the `at`th poll on, nothing before it
+private:
+        unsigned polls;
+        unsigned at;
+        unsigned short pressed;
+public:
+        PressAt(unsigned poll, unsigned short keys) : polls(0), at(poll), pressed(keys) {}
+        unsigned short pollKeys() { return ++polls >= at ? pressed : 0; }
+};
+
+static bool sameState(const Chip8State& a, const Chip8State& b)
+{
+        return memcmp(a.V, b.V, sizeof a.V) == 0 && a.I == b.I && a.pc == b.pc
+            && a.delay_timer == b.delay_timer && a.sound_timer == b.sound_timer;
+}
+
+static void checkFastForward(const RomImage& rom, unsigned short leftAt, unsigned pressAt, unsigned long perFrame)
+{ // Fast-forwarding a polling loop has to end up exactly where running every trip does, after every frame, and leave the loop on the same frame
+        const Chip8::Engine engines[] = {Chip8::INTERPRETER, Chip8::BLOCKS, Chip8::JIT};
+        const char* engineNames[] = {"interpreter", "blocks", "jit"};
+        for(unsigned e = 0; e < 3; ++e)
+        {
+                string test = rom.name + " (" + engineNames[e] + ")";
+                Chip8* machines[2];
+                PressAt* inputs[2];
+                unsigned left[2] = {0, 0};
+                for(unsigned m = 0; m < 2; ++m)
+                {
+                        machines[m] = new Chip8;
+                        inputs[m] = new PressAt(pressAt, 1 << 5);
+                        machines[m]->setEngine(engines[e]);
+                        machines[m]->setFastForward(m == 0);
+                        machines[m]->setInput(inputs[m]);
+                        check(machines[m]->loadROM(rom), test, "didn't load");
+                }
+
+                bool same = true;
+                for(unsigned frame = 1; frame <= 60; ++frame)
+                {
+                        Chip8State states[2];
+                        for(unsigned m = 0; m < 2; ++m)
+                        {
+                                machines[m]->run(perFrame);
+                                machines[m]->tickTimers();
+                                machines[m]->saveState(states[m]);
+                                if(!left[m] && states[m].pc >= leftAt)
+                                        left[m] = frame;
+                        }
+                        same = same && sameState(states[0], states[1]);
+                }
+                check(same, test, "fast-forwarding ended up somewhere else");
+                check(left[0] && left[0] == left[1], test, "fast-forwarding left the loop on another frame");
+                check(machines[0]->getFastForwarded() > 0, test, "nothing was fast-forwarded");
+                check(machines[1]->getFastForwarded() == 0, test, "fast-forwarded while switched off");
+
+                for(unsigned m = 0; m < 2; ++m)
+                {
+                        delete machines[m];
+                        delete inputs[m];
+                }
+        }
+}
+
+static void fastForwardTimerPoll()
+{ // FX07; 3X00; 1NNN waiting on the delay timer, with the sound timer running too
+        vector<unsigned char> program(0x18);
+        putOpcode(program, 0x200, 0x6020); // delay = 0x20
+        putOpcode(program, 0x202, 0xF015);
+        putOpcode(program, 0x204, 0x6110); // sound = 0x10
+        putOpcode(program, 0x206, 0xF118);
+        putOpcode(program, 0x208, 0xF007); // V0 = delay
+        putOpcode(program, 0x20A, 0x3000); // Out once it's 0
+        putOpcode(program, 0x20C, 0x1208);
+        putOpcode(program, 0x20E, 0x7201);
+        putOpcode(program, 0x210, 0xA321);
+        putOpcode(program, 0x212, 0x1212);
+        checkFastForward(makeROM("fast-forward, timer poll", program), 0x20E, 0, 1000);
+        checkFastForward(makeROM("fast-forward, timer poll at 500 Hz", program), 0x20E, 0, 9);
+}
+
+static void fastForwardKeyPoll()
+{ // EX9E; 1NNN waiting on key 5, pressed at the 25th tick: the loop has to be left the frame after that tick in either case
+        vector<unsigned char> program(0x0E);
+        putOpcode(program, 0x200, 0x6005); // V0 = 5
+        putOpcode(program, 0x202, 0xA300);
+        putOpcode(program, 0x204, 0xE09E); // Out once key 5 is down
+        putOpcode(program, 0x206, 0x1204);
+        putOpcode(program, 0x208, 0x7101);
+        putOpcode(program, 0x20A, 0xF11E); // I += V1
+        putOpcode(program, 0x20C, 0x120C);
+        checkFastForward(makeROM("fast-forward, key poll", program), 0x208, 25, 1000);
+        checkFastForward(makeROM("fast-forward, key poll at 500 Hz", program), 0x208, 25, 9);
+}
+
+int main()
+{
+        runOffTheEnd();
+        skipOffTheEnd();
+        writeWrapsRound();
+        xochipUpperMemory();
+        xochipCodePastEnd();
+        pooledReset();
+        fastForwardTimerPoll();
+        fastForwardKeyPoll();
+        waitForPress();
+        movieReplay();
+        saveAndLoad();
+        rewindFrames();
+        schedulerCarry();
+        traceRing();
+        enginesAgree();
+
+        if(failures)
+        {
+                cerr << failures << " checks failed" << endl;
+                return 1;
+        }
+        cerr << "All tests passed" << endl;
+        return 0;
+}
@@ -0,0 +1,84 @@
+#include "Trace.h"
+#include <chrono>
+#include <iomanip>
+
+Chip8Trace::Chip8Trace(unsigned capacityLog2)
+        : records(size_t(1) << capacityLog2), mask((size_t(1) << capacityLog2) - 1), head(0), tail(0), dropped(0)
+{
+}
+
+size_t Chip8Trace::dumpText(ostream& out)
+{ // Pops every record pushed so far and writes one line per record, returns how many
+        size_t t = tail.load(memory_order_relaxed);
+        size_t h = head.load(memory_order_acquire);
+        for(size_t i = t; i != h; ++i)
+        {
+                const TraceRecord& r = records[i & mask];
+                out << hex << setfill('0')
+                    << (r.block ? "BLK " : "PC ") << setw(3) << r.pc
+                    << " OP " << setw(4) << r.opcode
+                    << " I " << setw(3) << r.I
+                    << " SP " << (int) r.sp << '\n';
+        }
+        out << dec << setfill(' ');
+        tail.store(h, memory_order_release);
+        return h - t;
+}
+
+void Chip8Trace::writeBinaryHeader(ostream& out)
+{ // "C8TR", format version, record size
+        const char header[8] = { 'C', '8', 'T', 'R', 1, 0, (char) sizeof(TraceRecord), 0 };
+        out.write(header, sizeof(header));
+}
+
+size_t Chip8Trace::dumpBinary(ostream& out)
+{ // Pops every record pushed so far and writes them as raw 8-byte records, returns how many
+        size_t t = tail.load(memory_order_relaxed);
+        size_t h = head.load(memory_order_acquire);
+        for(size_t i = t; i != h; )
+        { // At most two contiguous runs, split where the ring wraps
+                size_t start = i & mask;
+                size_t run = h - i < records.size() - start ? h - i : records.size() - start;
+                out.write(reinterpret_cast<const char*>(&records[start]), run * sizeof(TraceRecord));
+                i += run;
+        }
+        tail.store(h, memory_order_release);
+        return h - t;
+}
+
+unsigned long Chip8Trace::getDropped() const
+{ // Records lost because the buffer was full when they were pushed
+        return dropped.load(memory_order_relaxed);
+}
+
+Chip8TraceWriter::Chip8TraceWriter(Chip8Trace& source, ostream& sink, bool binaryFormat)
+        : trace(source), out(sink), binary(binaryFormat), running(true)
+{
+        if(binary)
+                Chip8Trace::writeBinaryHeader(out);
+        worker = thread(&Chip8TraceWriter::loop, this);
+}
+
+Chip8TraceWriter::~Chip8TraceWriter()
+{
+        stop();
+}
+
+void Chip8TraceWriter::loop()
+{
+        while(running.load())
+        {
+                if((binary ? trace.dumpBinary(out) : trace.dumpText(out)) == 0)
+                        this_thread::sleep_for(chrono::milliseconds(5));
+        }
+}
+
+void Chip8TraceWriter::stop()
+{ // Joins the thread and writes out whatever is still buffered
+        if(!worker.joinable())
+                return;
+        running.store(false);
+        worker.join();
+        binary ? trace.dumpBinary(out) : trace.dumpText(out);
+        out.flush();
+}
@@ -0,0 +1,88 @@
+#ifndef TRACE_H
+
+#define TRACE_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <ostream>
+#include <stdint.h>
+
+using namespace std;
+
+// One executed instruction (or, with the block engine, one executed block)
+struct TraceRecord
+{
+        uint16_t pc;
+        uint16_t opcode;
+        uint16_t I;
+        uint8_t sp;
+        uint8_t block; // 1 when the record stands for a whole translated block
+};
+
+// Single-producer single-consumer ring buffer of trace records. The CPU thread
+// pushes and never waits: when the buffer is full the record is dropped and
+// counted. Dumping pops whatever has accumulated, from any one other thread.
+class Chip8Trace
+{
+private:
+        vector<TraceRecord> records;
+        size_t mask;
+
+        atomic<size_t> head;           // Next slot to write, only moved by the producer
+        atomic<size_t> tail;           // Next slot to read, only moved by the consumer
+        atomic<unsigned long> dropped;
+public:
+        Chip8Trace(unsigned capacityLog2 = 16);
+
+        void push(uint16_t pc, uint16_t opcode, uint16_t I, uint8_t sp, uint8_t block)
+        {
+                size_t h = head.load(memory_order_relaxed);
+                if(h - tail.load(memory_order_acquire) > mask)
+                {
+                        dropped.fetch_add(1, memory_order_relaxed);
+                        return;
+                }
+                TraceRecord& r = records[h & mask];
+                r.pc = pc;
+                r.opcode = opcode;
+                r.I = I;
+                r.sp = sp;
+                r.block = block;
+                head.store(h + 1, memory_order_release);
+        }
+
+        size_t dumpText(ostream& out);
+        size_t dumpBinary(ostream& out);
+        unsigned long getDropped() const;
+
+        static void writeBinaryHeader(ostream& out);
+};
+
+// Background thread that drains a trace into a stream until stopped
+class Chip8TraceWriter
+{
+private:
+        Chip8Trace& trace;
+        ostream& out;
+        bool binary;
+        atomic<bool> running;
+        thread worker;
+
+        void loop();
+public:
+        Chip8TraceWriter(Chip8Trace& source, ostream& sink, bool binaryFormat);
+        ~Chip8TraceWriter();
+        void stop();
+};
+
+// Tracing is compiled in only with -DCHIP8_TRACE (make TRACE=1); otherwise the
+// hook below expands to nothing and the hot path doesn't even test for a buffer.
+#ifdef CHIP8_TRACE
+#define CHIP8_TRACE_RECORD(trace, pc, opcode, I, sp, block) \
+        do { if(trace) (trace)->push((pc), (opcode), (I), (sp), (block)); } while(0)
+#else
+#define CHIP8_TRACE_RECORD(trace, pc, opcode, I, sp, block) do { } while(0)
+#endif
+
+#endif
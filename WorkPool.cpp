@@ -0,0 +1,87 @@
+#include "WorkPool.h"
+#include <thread>
+
+WorkPool::WorkPool(unsigned threadCount)
+{ // 0 threads means one per hardware thread
+        threads = threadCount ? threadCount : thread::hardware_concurrency();
+        if(threads == 0)
+                threads = 1;
+}
+
+unsigned WorkPool::getThreads() const
+{
+        return threads;
+}
+
+bool WorkPool::take(Queue& queue, unsigned& job, bool own)
+{ // Workers take from the back of their own queue and steal from the front of others'
+        lock_guard<mutex> guard(queue.lock);
+        if(queue.jobs.empty())
+                return false;
+
+        if(own)
+        {
+                job = queue.jobs.back();
+                queue.jobs.pop_back();
+        } else
+        {
+                job = queue.jobs.front();
+                queue.jobs.pop_front();
+        }
+        return true;
+}
+
+void WorkPool::run(unsigned jobs, const function<void(unsigned job)>& work)
+{ // Calls work(0) to work(jobs - 1), each exactly once, and returns when all are done
+        unsigned workers = threads < jobs ? threads : (jobs ? jobs : 1);
+
+        vector<Queue*> queues(workers);
+        for(unsigned w = 0; w < workers; ++w)
+        {
+                queues[w] = new Queue;
+                // Own jobs are taken from the back, push them in reverse so they run in order
+                for(unsigned job = (unsigned long) (w + 1) * jobs / workers; job-- > (unsigned long) w * jobs / workers; )
+                {
+                        queues[w]->jobs.push_back(job);
+                }
+        }
+
+        // No jobs are added once running, so a worker that finds every queue empty is done
+        auto worker = [&](unsigned w)
+        {
+                unsigned job;
+                for(;;)
+                {
+                        if(take(*queues[w], job, true))
+                        {
+                                work(job);
+                                continue;
+                        }
+
+                        bool stole = false;
+                        for(unsigned i = 1; i < workers && !stole; ++i)
+                        {
+                                stole = take(*queues[(w + i) % workers], job, false);
+                        }
+                        if(!stole)
+                                break;
+                        work(job);
+                }
+        };
+
+        vector<thread> pool;
+        for(unsigned w = 1; w < workers; ++w)
+        {
+                pool.push_back(thread(worker, w));
+        }
+        worker(0); // The calling thread works too
+        for(unsigned i = 0; i < pool.size(); ++i)
+        {
+                pool[i].join();
+        }
+
+        for(unsigned w = 0; w < workers; ++w)
+        {
+                delete queues[w];
+        }
+}
@@ -0,0 +1,35 @@
+#ifndef WORKPOOL_H
+
+#define WORKPOOL_H
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+// Runs a batch of independent jobs over a fixed number of threads. Every worker
+// starts on an even, contiguous share of the jobs and, once it has run out,
+// steals from the far end of the other workers' shares, so uneven jobs (a ROM
+// that halts early next to one that runs its full budget) still keep every core busy.
+class WorkPool
+{
+private:
+        struct Queue
+        {
+                mutex lock;
+                deque<unsigned> jobs;
+        };
+
+        unsigned threads;
+
+        static bool take(Queue& queue, unsigned& job, bool own);
+public:
+        WorkPool(unsigned threadCount = 0);
+
+        unsigned getThreads() const;
+        void run(unsigned jobs, const function<void(unsigned job)>& work);
+};
+
+#endif